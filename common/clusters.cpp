@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTERS_SSE2 1
+#endif
+
+#include "clusters.hpp"
+#include "parallel.hpp"
+#include "resources.hpp"
+
+// Padding bounds no light can ever reach
+static const float far_away = 1e30f;
+
+LightClusters::LightClusters(int tilesX, int tilesY, int slices,
+                             float clusterNear, float clusterFar,
+                             int maxLightsPerCluster)
+    : tilesX(tilesX), tilesY(tilesY), slices(slices),
+      clusterNear(clusterNear), clusterFar(clusterFar),
+      maxLightsPerCluster(maxLightsPerCluster),
+      paddedX((tilesX + 3) & ~3),
+      clusterLights(size_t(tilesX) * tilesY * slices) {}
+
+void LightClusters::setup() {
+  static const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+  glGenBuffers(3, buffers);
+  glGenTextures(3, textures);
+  for (int i = 0; i < 3; i++) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+  }
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::unload() {
+  for (int i = 0; i < 3; i++)
+    resources().untrackBuffer(buffers[i]);
+  resources().trackHost("lights", "cluster lists", 0);
+  glDeleteTextures(3, textures);
+  glDeleteBuffers(3, buffers);
+  for (int i = 0; i < 3; i++) {
+    textures[i] = 0;
+    buffers[i] = 0;
+  }
+}
+
+void LightClusters::buildBounds(const glm::mat4 &projection) {
+  boundsProjection = projection;
+  // Only symmetric perspective projections, as glm::perspective makes them
+  float p00 = projection[0][0];
+  float p11 = projection[1][1];
+  projectionNear = projection[3][2] / (projection[2][2] - 1.0f);
+  projectionFar = projection[3][2] / (projection[2][2] + 1.0f);
+
+  columnMinX.assign(size_t(slices) * paddedX, far_away);
+  columnMaxX.assign(size_t(slices) * paddedX, far_away);
+  rowMinY.resize(size_t(slices) * tilesY);
+  rowMaxY.resize(size_t(slices) * tilesY);
+  sliceMinZ.resize(slices);
+  sliceMaxZ.resize(slices);
+
+  // The first and last slices stretch out to the projection's planes, so
+  // every visible fragment lands in some froxel
+  float ratio = clusterFar / clusterNear;
+  for (int k = 0; k < slices; k++) {
+    float z0 = k == 0 ? projectionNear
+                      : clusterNear * std::pow(ratio, float(k) / slices);
+    float z1 = k == slices - 1
+                   ? projectionFar
+                   : clusterNear * std::pow(ratio, float(k + 1) / slices);
+    sliceMinZ[k] = z0;
+    sliceMaxZ[k] = z1;
+
+    // A point at depth d and NDC x sits at x * d / p00 in view space
+    for (int x = 0; x < tilesX; x++) {
+      float n0 = -1.0f + 2.0f * x / tilesX;
+      float n1 = -1.0f + 2.0f * (x + 1) / tilesX;
+      columnMinX[k * paddedX + x] = std::min(n0 * z0, n0 * z1) / p00;
+      columnMaxX[k * paddedX + x] = std::max(n1 * z0, n1 * z1) / p00;
+    }
+    for (int y = 0; y < tilesY; y++) {
+      float n0 = -1.0f + 2.0f * y / tilesY;
+      float n1 = -1.0f + 2.0f * (y + 1) / tilesY;
+      rowMinY[k * tilesY + y] = std::min(n0 * z0, n0 * z1) / p11;
+      rowMaxY[k * tilesY + y] = std::max(n1 * z0, n1 * z1) / p11;
+    }
+  }
+}
+
+// Sphere against froxel box, per axis: the distance from the centre to the
+// box is zero inside it, the same test the shaders' attenuation cuts off at
+void LightClusters::binSlice(int slice) {
+  std::vector<uint32_t> *out = &clusterLights[size_t(slice) * tilesX * tilesY];
+  for (int i = 0; i < tilesX * tilesY; i++)
+    out[i].clear();
+
+  float zMin = sliceMinZ[slice];
+  float zMax = sliceMaxZ[slice];
+  const float *minX = &columnMinX[size_t(slice) * paddedX];
+  const float *maxX = &columnMaxX[size_t(slice) * paddedX];
+  const float *minY = &rowMinY[size_t(slice) * tilesY];
+  const float *maxY = &rowMaxY[size_t(slice) * tilesY];
+
+  auto binLight = [&](int l) {
+    float lx = lightX[l];
+    float ly = lightY[l];
+    float d = -lightZ[l];
+    float r = lightRadius[l];
+    float dz = std::max(0.0f, std::max(zMin - d, d - zMax));
+    float remaining = r * r - dz * dz;
+    if (remaining < 0.0f)
+      return;
+
+    for (int y = 0; y < tilesY; y++) {
+      float dy = std::max(0.0f, std::max(minY[y] - ly, ly - maxY[y]));
+      float remainingY = remaining - dy * dy;
+      if (remainingY < 0.0f)
+        continue;
+      std::vector<uint32_t> *row = out + y * tilesX;
+#ifdef CLUSTERS_SSE2
+      __m128 x4 = _mm_set1_ps(lx);
+      __m128 limit = _mm_set1_ps(remainingY);
+      __m128 zero = _mm_setzero_ps();
+      for (int x = 0; x < paddedX; x += 4) {
+        __m128 below = _mm_sub_ps(_mm_loadu_ps(minX + x), x4);
+        __m128 above = _mm_sub_ps(x4, _mm_loadu_ps(maxX + x));
+        __m128 dx = _mm_max_ps(zero, _mm_max_ps(below, above));
+        int hits = _mm_movemask_ps(_mm_cmple_ps(_mm_mul_ps(dx, dx), limit));
+        for (int j = 0; hits != 0; j++, hits >>= 1)
+          if (hits & 1)
+            row[x + j].push_back(uint32_t(l));
+      }
+#else
+      for (int x = 0; x < tilesX; x++) {
+        float dx = std::max(0.0f, std::max(minX[x] - lx, lx - maxX[x]));
+        if (dx * dx <= remainingY)
+          row[x].push_back(uint32_t(l));
+      }
+#endif
+    }
+  };
+
+  // Cheap depth rejection four lights at a time first, most lights miss
+  // most slices
+#ifdef CLUSTERS_SSE2
+  __m128 zMin4 = _mm_set1_ps(zMin);
+  __m128 zMax4 = _mm_set1_ps(zMax);
+  for (int l = 0; l < lightCount; l += 4) {
+    __m128 d = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&lightZ[l]));
+    __m128 r = _mm_loadu_ps(&lightRadius[l]);
+    __m128 inside = _mm_and_ps(_mm_cmpgt_ps(_mm_add_ps(d, r), zMin4),
+                               _mm_cmplt_ps(_mm_sub_ps(d, r), zMax4));
+    int hits = _mm_movemask_ps(inside);
+    for (int j = 0; hits != 0; j++, hits >>= 1)
+      if (hits & 1)
+        binLight(l + j);
+  }
+#else
+  for (int l = 0; l < lightCount; l++) {
+    float d = -lightZ[l];
+    if (d + lightRadius[l] > zMin && d - lightRadius[l] < zMax)
+      binLight(l);
+  }
+#endif
+}
+
+// Replaces a texture buffer's contents, orphaning the old store so the
+// upload doesn't wait on frames still reading it
+static void uploadBuffer(GLuint buffer, const char *name, const void *data,
+                         size_t bytes) {
+  static const uint32_t empty[4] = {0, 0, 0, 0};
+  if (bytes == 0) {
+    data = empty;
+    bytes = sizeof(empty);
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW);
+  // The texture views over these buffers have no storage of their own
+  resources().trackBuffer(buffer, "lights", name, bytes);
+}
+
+void LightClusters::update(const std::vector<PointLight> &lights,
+                           const glm::mat4 &view,
+                           const glm::mat4 &projection) {
+  auto start = std::chrono::steady_clock::now();
+  if (projection != boundsProjection)
+    buildBounds(projection);
+
+  lightCount = int(lights.size());
+  size_t padded = (lights.size() + 3) & ~size_t(3);
+  lightX.assign(padded, 0.0f);
+  lightY.assign(padded, 0.0f);
+  // Padding sits behind the camera with no radius, it never passes the
+  // depth test
+  lightZ.assign(padded, far_away);
+  lightRadius.assign(padded, 0.0f);
+  lightData.resize(lights.size() * 2);
+  for (int l = 0; l < lightCount; l++) {
+    const PointLight &light = lights[l];
+    glm::vec3 p = glm::vec3(view * glm::vec4(light.position, 1.0f));
+    lightX[l] = p.x;
+    lightY[l] = p.y;
+    lightZ[l] = p.z;
+    lightRadius[l] = light.radius;
+    lightData[l * 2] = glm::vec4(p, light.radius);
+    lightData[l * 2 + 1] = glm::vec4(light.color * light.power, 0.0f);
+  }
+
+  // Every slice owns its own froxels, so the jobs never share a list
+  parallelFor(slices, [this](int begin, int end) {
+    for (int k = begin; k < end; k++)
+      binSlice(k);
+  });
+
+  // Flatten the lists, capping each froxel so one hot spot can't stall
+  // its fragments
+  grid.resize(clusterLights.size() * 2);
+  indices.clear();
+  dropped = 0;
+  for (size_t i = 0; i < clusterLights.size(); i++) {
+    const std::vector<uint32_t> &list = clusterLights[i];
+    size_t count = std::min(list.size(), size_t(maxLightsPerCluster));
+    grid[i * 2] = uint32_t(indices.size());
+    grid[i * 2 + 1] = uint32_t(count);
+    indices.insert(indices.end(), list.begin(), list.begin() + count);
+    dropped += list.size() - count;
+  }
+
+  uploadBuffer(buffers[0], "light data", lightData.data(),
+               lightData.size() * sizeof(glm::vec4));
+  uploadBuffer(buffers[1], "cluster grid", grid.data(),
+               grid.size() * sizeof(uint32_t));
+  uploadBuffer(buffers[2], "cluster indices", indices.data(),
+               indices.size() * sizeof(uint32_t));
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  // Four structure of arrays light vectors plus the flattened lists
+  size_t hostBytes = 4 * lightX.capacity() * sizeof(float) +
+                     lightData.capacity() * sizeof(glm::vec4) +
+                     (grid.capacity() + indices.capacity()) * sizeof(uint32_t);
+  for (const std::vector<uint32_t> &list : clusterLights)
+    hostBytes += list.capacity() * sizeof(uint32_t);
+  resources().trackHost("lights", "cluster lists", hostBytes);
+
+  updateMs = std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - start)
+                 .count();
+}
+
+void LightClusters::bind(GLuint programID, int firstUnit,
+                         glm::ivec2 viewportSize) const {
+  static const char *samplers[3] = {"ClusterLightSampler", "ClusterGridSampler",
+                                    "ClusterIndexSampler"};
+  for (int i = 0; i < 3; i++) {
+    glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+    glUniform1i(glGetUniformLocation(programID, samplers[i]), firstUnit + i);
+  }
+
+  glUniform3i(glGetUniformLocation(programID, "ClusterTiles"), tilesX, tilesY,
+              slices);
+  glUniform2f(glGetUniformLocation(programID, "ClusterTileSize"),
+              float(viewportSize.x) / tilesX, float(viewportSize.y) / tilesY);
+  glUniform1f(glGetUniformLocation(programID, "ClusterNear"), clusterNear);
+  glUniform1f(glGetUniformLocation(programID, "ClusterDepthScale"),
+              slices / std::log(clusterFar / clusterNear));
+}
@@ -0,0 +1,86 @@
+#ifndef CLUSTERS_HPP
+#define CLUSTERS_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+struct PointLight {
+  glm::vec3 position;
+  // Distance at which the light has faded out completely
+  float radius;
+  glm::vec3 color;
+  float power;
+};
+
+// Clustered forward lighting. The view frustum is cut into tilesX x tilesY
+// screen tiles and exponentially spaced depth slices; every frame the lights
+// are assigned to the froxels they touch on the CPU (SSE2, one job per
+// slice), and the fragment shaders only loop over the lights of their own
+// froxel. The result lives in three texture buffers:
+//   lights   RGBA32F, two texels per light: view-space position + radius,
+//            colour * power
+//   grid     RG32UI, one texel per froxel: offset into indices, light count
+//   indices  R32UI, light indices of every froxel back to back
+class LightClusters {
+public:
+  LightClusters(int tilesX = 16, int tilesY = 9, int slices = 24,
+                float clusterNear = 0.5f, float clusterFar = 100.0f,
+                int maxLightsPerCluster = 256);
+
+  // Creates the buffers, needs a current GL context
+  void setup();
+  void unload();
+
+  // Bins lights for this view and uploads the result
+  void update(const std::vector<PointLight> &lights, const glm::mat4 &view,
+              const glm::mat4 &projection);
+
+  // Binds the buffers to three consecutive texture units starting at
+  // firstUnit and sets the cluster uniforms of programID. viewportSize is the
+  // size in pixels that gl_FragCoord refers to.
+  void bind(GLuint programID, int firstUnit, glm::ivec2 viewportSize) const;
+
+  int getClusterCount() const { return tilesX * tilesY * slices; }
+  // Light references written by the last update, after the per-froxel cap
+  size_t getReferenceCount() const { return indices.size(); }
+  // Light references the per-froxel cap threw away in the last update
+  size_t getDroppedCount() const { return dropped; }
+  // CPU time of the last update, binning and upload
+  double getUpdateMs() const { return updateMs; }
+
+private:
+  void buildBounds(const glm::mat4 &projection);
+  void binSlice(int slice);
+
+  int tilesX, tilesY, slices;
+  float clusterNear, clusterFar;
+  int maxLightsPerCluster;
+
+  // View-space froxel bounds. They are separable: a column's x extent and a
+  // row's y extent only depend on the slice, so they're stored per slice.
+  glm::mat4 boundsProjection = glm::mat4(0.0f);
+  float projectionNear = 0, projectionFar = 0;
+  std::vector<float> columnMinX, columnMaxX; // slices * paddedX
+  std::vector<float> rowMinY, rowMaxY;       // slices * tilesY
+  std::vector<float> sliceMinZ, sliceMaxZ;   // depth, positive away from camera
+  int paddedX;
+
+  // View-space lights, structure of arrays padded to a multiple of four
+  std::vector<float> lightX, lightY, lightZ, lightRadius;
+  int lightCount = 0;
+
+  std::vector<std::vector<uint32_t>> clusterLights;
+  std::vector<uint32_t> grid;
+  std::vector<uint32_t> indices;
+  std::vector<glm::vec4> lightData;
+  size_t dropped = 0;
+  double updateMs = 0.0;
+
+  GLuint buffers[3] = {0, 0, 0};
+  GLuint textures[3] = {0, 0, 0};
+};
+
+#endif
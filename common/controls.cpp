@@ -5,6 +5,9 @@ extern GLFWwindow
              // declared in tutorialXXX.cpp. This is a hack to keep the
              // tutorials simple. Please avoid this.
 
+#include <chrono>
+#include <thread>
+
 // Include GLM
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -31,13 +34,56 @@ glm::vec3 getCameraPosition() { return position; }
 float speed = 3.0f; // 3 units / second
 float mouseSpeed = 0.005f;
 
+void setCamera(const glm::vec3 &newPosition, float newHorizontalAngle,
+               float newVerticalAngle) {
+  position = newPosition;
+  horizontalAngle = newHorizontalAngle;
+  verticalAngle = newVerticalAngle;
+
+  // Same conversions as computeMatricesFromInputs
+  glm::vec3 direction(cos(verticalAngle) * sin(horizontalAngle),
+                      sin(verticalAngle),
+                      cos(verticalAngle) * cos(horizontalAngle));
+  glm::vec3 right = glm::vec3(sin(horizontalAngle - 3.14f / 2.0f), 0,
+                              cos(horizontalAngle - 3.14f / 2.0f));
+  glm::vec3 up = glm::cross(right, direction);
+
+  ProjectionMatrix =
+      glm::perspective(glm::radians(initialFoV), 4.0f / 3.0f, 0.1f, 500.0f);
+  ViewMatrix = glm::lookAt(position, position + direction, up);
+}
+
+// Late input sampling, see setInputSampleDeadline
+double inputSampleDeadline = 0.0;
+double inputSampleTime = 0.0;
+
+void setInputSampleDeadline(double deadline) { inputSampleDeadline = deadline; }
+double getInputSampleTime() { return inputSampleTime; }
+
+// Sleeps most of the way, then yields for the last stretch, since sleeps
+// tend to overshoot by about a scheduler tick
+static void sleepUntil(double deadline) {
+  double remaining = deadline - glfwGetTime();
+  if (remaining > 0.002)
+    std::this_thread::sleep_for(std::chrono::duration<double>(remaining - 0.002));
+  while (glfwGetTime() < deadline)
+    std::this_thread::yield();
+}
+
 void computeMatricesFromInputs() {
 
+  // Wait for the deadline, then pick up the events that came in meanwhile
+  if (inputSampleDeadline > 0.0 && glfwGetTime() < inputSampleDeadline) {
+    sleepUntil(inputSampleDeadline);
+    glfwPollEvents();
+  }
+
   // glfwGetTime is called only once, the first time this function is called
   static double lastTime = glfwGetTime();
 
   // Compute time difference between current and last frame
   double currentTime = glfwGetTime();
+  inputSampleTime = currentTime;
   float deltaTime = float(currentTime - lastTime);
 
   // Get mouse position
@@ -4,7 +4,16 @@
 #include <glm/fwd.hpp>
 
 void computeMatricesFromInputs();
+// Makes the next computeMatricesFromInputs sleep until deadline (glfwGetTime
+// seconds) and poll events again before sampling, so input is as fresh as
+// possible. 0 samples right away.
+void setInputSampleDeadline(double deadline);
+// When computeMatricesFromInputs last read input
+double getInputSampleTime();
 glm::mat4 getViewMatrix();
 glm::mat4 getProjectionMatrix();
 glm::vec3 getCameraPosition();
+// Places the camera without reading input, for scripted views
+void setCamera(const glm::vec3 &newPosition, float newHorizontalAngle,
+               float newVerticalAngle);
 #endif
\ No newline at end of file
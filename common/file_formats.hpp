@@ -0,0 +1,64 @@
+#ifndef FILE_FORMATS_HPP
+#define FILE_FORMATS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// Header parsing shared by the heightmap loader, the texture baker and the
+// KTX loader
+
+inline uint16_t readU16(const uint8_t *p) { return uint16_t(p[0] | p[1] << 8); }
+
+inline int32_t readI32(const uint8_t *p) {
+  return int32_t(uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+                 uint32_t(p[3]) << 24);
+}
+
+// Where the pixels of an uncompressed 24/32bpp BMP are, B, G, R(, A) order
+struct BMPLayout {
+  int width = 0;
+  int height = 0;
+  int pixelStride = 0;
+  // Rows are padded to 4 bytes
+  size_t rowStride = 0;
+  size_t offset = 0;
+  // First row in the file is the bottom of the image (GL's row 0)
+  bool bottomUp = true;
+};
+
+// Checks the header and that every row fits in size bytes
+inline bool parseBMPHeader(const uint8_t *data, size_t size, BMPLayout &out) {
+  if (size < 54 || data[0] != 'B' || data[1] != 'M') {
+    printf("Not a correct BMP file\n");
+    return false;
+  }
+
+  int bpp = readU16(data + 0x1C);
+  if (readI32(data + 0x1E) != 0 || (bpp != 24 && bpp != 32)) {
+    printf("Only uncompressed 24/32bpp BMP files are supported\n");
+    return false;
+  }
+
+  int32_t height = readI32(data + 0x16);
+  out.width = readI32(data + 0x12);
+  out.height = std::abs(height);
+  out.bottomUp = height > 0;
+  out.pixelStride = bpp / 8;
+  out.rowStride = (size_t(out.width) * out.pixelStride + 3) & ~size_t(3);
+  out.offset = size_t(readI32(data + 0x0A));
+  if (out.offset == 0)
+    out.offset = 54;
+  if (out.width <= 0 || out.height == 0 ||
+      out.offset + out.rowStride * out.height > size) {
+    printf("BMP file is truncated\n");
+    return false;
+  }
+  return true;
+}
+
+// KTX 1.1 file identifier
+static const uint8_t ktx_identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+#endif
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "file_formats.hpp"
+#include "heightmap.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+
+// Upper bound on the converted rows held in memory at once
+static const size_t block_budget = 16 << 20;
+
+// A 16-bit sample of 255 is one unit of height, as it was when the top byte
+// of a 16-bit height sat in the red channel of a BMP
+static const float r16_value_range = 65535.0f / 255.0f;
+// Packed 24-bit RGB heights, scaled the same way
+static const float packed_rgb_scale = 1.0f / (255.0f * 256.0f);
+
+enum class SourceFormat {
+  PackedBGR, // BMP, heights spread over the colour channels
+  Gray8,
+  Gray16BE, // PGM stores 16-bit samples big endian
+  Gray16LE,
+  Float32
+};
+
+struct SourceLayout {
+  SourceFormat format;
+  int width = 0;
+  int height = 0;
+  size_t offset = 0;
+  size_t rowStride = 0;
+  int pixelStride = 0;
+  // First row in the file is the bottom of the image (GL's row 0)
+  bool bottomUp = false;
+};
+
+static bool endsWith(const std::string &s, const char *suffix) {
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static bool parseBMP(const MappedFile &file, SourceLayout &layout) {
+  BMPLayout bmp;
+  if (!parseBMPHeader(file.data(), file.size(), bmp))
+    return false;
+  layout.format = SourceFormat::PackedBGR;
+  layout.width = bmp.width;
+  layout.height = bmp.height;
+  layout.bottomUp = bmp.bottomUp;
+  layout.pixelStride = bmp.pixelStride;
+  layout.rowStride = bmp.rowStride;
+  layout.offset = bmp.offset;
+  return true;
+}
+
+// Skips whitespace and comments, then reads one unsigned number
+static bool readPGMNumber(const MappedFile &file, size_t &pos, int &value) {
+  const unsigned char *p = file.data();
+  while (pos < file.size()) {
+    if (p[pos] == '#') {
+      while (pos < file.size() && p[pos] != '\n')
+        pos++;
+    } else if (isspace(p[pos])) {
+      pos++;
+    } else {
+      break;
+    }
+  }
+  if (pos >= file.size() || !isdigit(p[pos]))
+    return false;
+  value = 0;
+  while (pos < file.size() && isdigit(p[pos]))
+    value = value * 10 + (p[pos++] - '0');
+  return true;
+}
+
+static bool parsePGM(const MappedFile &file, SourceLayout &layout) {
+  const unsigned char *header = file.data();
+  if (file.size() < 2 || header[0] != 'P' || header[1] != '5') {
+    printf("Only binary (P5) PGM heightmaps are supported\n");
+    return false;
+  }
+
+  size_t pos = 2;
+  int maxValue;
+  if (!readPGMNumber(file, pos, layout.width) ||
+      !readPGMNumber(file, pos, layout.height) ||
+      !readPGMNumber(file, pos, maxValue) || maxValue <= 0 || maxValue > 65535) {
+    printf("Not a correct PGM file\n");
+    return false;
+  }
+
+  layout.format = maxValue > 255 ? SourceFormat::Gray16BE : SourceFormat::Gray8;
+  layout.pixelStride = maxValue > 255 ? 2 : 1;
+  layout.rowStride = size_t(layout.width) * layout.pixelStride;
+  // A single whitespace character separates the header from the samples
+  layout.offset = pos + 1;
+  layout.bottomUp = false;
+  return true;
+}
+
+static bool parseRaw(const MappedFile &file, SourceFormat format, int width,
+                     int height, SourceLayout &layout) {
+  layout.format = format;
+  layout.pixelStride = format == SourceFormat::Float32 ? 4 : 2;
+  size_t samples = file.size() / layout.pixelStride;
+  width = std::max(0, width);
+  height = std::max(0, height);
+  if (width == 0 && height == 0) {
+    // No size given, assume a square tile
+    width = height = int(std::lround(std::sqrt(double(samples))));
+  } else if (height == 0) {
+    height = int(samples / width);
+  } else if (width == 0) {
+    width = int(samples / height);
+  }
+  if (file.size() % layout.pixelStride != 0 ||
+      size_t(width) * size_t(height) != samples) {
+    printf("Raw heightmap holds %zu samples, not %dx%d\n", samples, width,
+           height);
+    return false;
+  }
+  layout.width = width;
+  layout.height = height;
+  layout.rowStride = size_t(width) * layout.pixelStride;
+  layout.offset = 0;
+  layout.bottomUp = false;
+  return true;
+}
+
+// Converts one row of the source, given as the GL row (0 = bottom), into dst
+static void convertRow(const SourceLayout &layout, const unsigned char *data,
+                       int glRow, unsigned char *dst) {
+  int fileRow = layout.bottomUp ? glRow : layout.height - 1 - glRow;
+  const unsigned char *src = data + layout.offset + size_t(fileRow) * layout.rowStride;
+
+  switch (layout.format) {
+  case SourceFormat::PackedBGR: {
+    float *out = reinterpret_cast<float *>(dst);
+    for (int x = 0; x < layout.width; x++, src += layout.pixelStride) {
+      uint32_t packed = uint32_t(src[2]) << 16 | uint32_t(src[1]) << 8 | src[0];
+      out[x] = float(packed) * packed_rgb_scale;
+    }
+    break;
+  }
+  case SourceFormat::Gray8: {
+    uint16_t *out = reinterpret_cast<uint16_t *>(dst);
+    for (int x = 0; x < layout.width; x++)
+      out[x] = uint16_t(src[x] * 257);
+    break;
+  }
+  case SourceFormat::Gray16BE: {
+    uint16_t *out = reinterpret_cast<uint16_t *>(dst);
+    for (int x = 0; x < layout.width; x++)
+      out[x] = uint16_t(src[2 * x] << 8 | src[2 * x + 1]);
+    break;
+  }
+  case SourceFormat::Gray16LE:
+  case SourceFormat::Float32:
+    memcpy(dst, src, layout.rowStride);
+    break;
+  }
+}
+
+bool loadHeightMap(const char *path, int rawWidth, int rawHeight,
+                   HeightMap &out) {
+  printf("Reading heightmap %s\n", path);
+  auto start = std::chrono::steady_clock::now();
+
+  MappedFile file;
+  if (!file.open(path)) {
+    printf("%s could not be opened. Are you in the right directory ? !\n",
+           path);
+    return false;
+  }
+
+  std::string name(path);
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+  SourceLayout layout;
+  bool parsed;
+  if (endsWith(name, ".bmp"))
+    parsed = parseBMP(file, layout);
+  else if (endsWith(name, ".pgm"))
+    parsed = parsePGM(file, layout);
+  else if (endsWith(name, ".r16"))
+    parsed = parseRaw(file, SourceFormat::Gray16LE, rawWidth, rawHeight, layout);
+  else if (endsWith(name, ".r32") || endsWith(name, ".f32"))
+    parsed = parseRaw(file, SourceFormat::Float32, rawWidth, rawHeight, layout);
+  else {
+    printf("Unknown heightmap format %s\n", path);
+    parsed = false;
+  }
+  if (!parsed)
+    return false;
+
+  size_t lastRowEnd = layout.offset + layout.rowStride * (layout.height - 1) +
+                      size_t(layout.width) * layout.pixelStride;
+  if (layout.width <= 0 || layout.height <= 0 || lastRowEnd > file.size()) {
+    printf("Heightmap %s is truncated\n", path);
+    return false;
+  }
+
+  GLint maxTextureSize;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  if (layout.width > maxTextureSize || layout.height > maxTextureSize) {
+    printf("Heightmap %dx%d is larger than the maximum texture size %d\n",
+           layout.width, layout.height, maxTextureSize);
+    return false;
+  }
+
+  bool r16 = layout.format == SourceFormat::Gray8 ||
+             layout.format == SourceFormat::Gray16BE ||
+             layout.format == SourceFormat::Gray16LE;
+  GLenum type = r16 ? GL_UNSIGNED_SHORT : GL_FLOAT;
+  size_t rowBytes = size_t(layout.width) * (r16 ? 2 : 4);
+
+  out.width = layout.width;
+  out.height = layout.height;
+  out.valueRange = r16 ? r16_value_range : 1.0f;
+
+  glGenTextures(1, &out.texture);
+  glBindTexture(GL_TEXTURE_2D, out.texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, r16 ? GL_R16 : GL_R32F, layout.width,
+               layout.height, 0, GL_RED, type, nullptr);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  int rowsPerBlock = int(std::max<size_t>(1, block_budget / rowBytes));
+  std::vector<unsigned char> staging(std::min(rowsPerBlock, layout.height) * rowBytes);
+
+  // Blocks go in file order whichever way up the rows are stored, so the
+  // sequential hint holds and readahead never brings back released pages
+  file.adviseSequential();
+  for (int fileRow0 = 0; fileRow0 < layout.height; fileRow0 += rowsPerBlock) {
+    int rows = std::min(rowsPerBlock, layout.height - fileRow0);
+    // Lowest GL row of the block
+    int row0 = layout.bottomUp ? fileRow0 : layout.height - fileRow0 - rows;
+
+    parallelFor(rows, [&](int begin, int end) {
+      for (int r = begin; r < end; r++)
+        convertRow(layout, file.data(), row0 + r, staging.data() + r * rowBytes);
+    });
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row0, layout.width, rows, GL_RED,
+                    type, staging.data());
+
+    // Done with these rows of the file, let the OS drop them
+    file.release(layout.offset + size_t(fileRow0) * layout.rowStride,
+                 size_t(rows) * layout.rowStride);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  printf("Heightmap %dx%d %s streamed in %.1f ms\n", layout.width,
+         layout.height, r16 ? "R16" : "R32F", ms);
+  return true;
+}
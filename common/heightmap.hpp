@@ -0,0 +1,26 @@
+#ifndef HEIGHTMAP_HPP
+#define HEIGHTMAP_HPP
+
+#include <GL/glew.h>
+
+struct HeightMap {
+  GLuint texture = 0;
+  int width = 0;
+  int height = 0;
+  // Multiply a texel by this to get the terrain height before HeightScale
+  float valueRange = 1.0f;
+};
+
+// Streams a heightmap from disk into a single channel texture, converting it
+// in row blocks so only one block is ever held in memory. Understands:
+//  - 24/32bpp BMP with heights packed into RGB, bottom-up or top-down rows
+//  - 8/16-bit binary PGM (P5)
+//  - headerless little-endian tiles: .r16 (uint16) and .r32/.f32 (float32)
+// 16-bit samples end up in a GL_R16 texture, everything else in GL_R32F.
+// rawWidth/rawHeight give the size of headerless tiles. A 0 is worked out
+// from the file size, both 0 means square, and a file that doesn't hold
+// exactly that many samples fails to load.
+bool loadHeightMap(const char *path, int rawWidth, int rawHeight,
+                   HeightMap &out);
+
+#endif
@@ -0,0 +1,199 @@
+#include <algorithm>
+
+#include "jobs.hpp"
+
+// Which queue the current thread owns, per job system
+static thread_local const JobSystem *currentSystem = nullptr;
+static thread_local int currentIndex = -1;
+
+JobSystem::JobSystem(int workerCount) : mainThread(std::this_thread::get_id()) {
+  if (workerCount < 0)
+    workerCount = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+
+  for (int i = 0; i <= workerCount; i++)
+    queues.emplace_back(new Queue);
+  for (int i = 0; i < workerCount; i++)
+    threads.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+JobSystem::Task JobSystem::makeTask(Job job, JobCounter *counter,
+                                    bool onMainThread) {
+  // Count the job now, so waiting on the counter covers held back jobs too
+  if (counter)
+    counter->count.fetch_add(1, std::memory_order_relaxed);
+  Task task;
+  task.job = std::move(job);
+  task.counter = counter;
+  task.mainThread = onMainThread;
+  return task;
+}
+
+void JobSystem::run(Job job, JobCounter *counter) {
+  schedule(makeTask(std::move(job), counter, false));
+}
+
+void JobSystem::runAfter(JobCounter &dependency, Job job, JobCounter *counter) {
+  runAfter(dependency, makeTask(std::move(job), counter, false));
+}
+
+void JobSystem::runOnMainThread(Job job, JobCounter *counter) {
+  schedule(makeTask(std::move(job), counter, true));
+}
+
+void JobSystem::runOnMainThreadAfter(JobCounter &dependency, Job job,
+                                     JobCounter *counter) {
+  runAfter(dependency, makeTask(std::move(job), counter, true));
+}
+
+void JobSystem::runAfter(JobCounter &dependency, Task task) {
+  {
+    // finish() takes the same lock before releasing, so the job is either
+    // parked here in time or the dependency is already done
+    std::lock_guard<std::mutex> lock(dependency.mutex);
+    if (!dependency.done()) {
+      auto shared = std::make_shared<Task>(std::move(task));
+      dependency.released.push_back([this, shared] { schedule(std::move(*shared)); });
+      return;
+    }
+  }
+  schedule(std::move(task));
+}
+
+void JobSystem::schedule(Task task) {
+  if (task.mainThread) {
+    std::lock_guard<std::mutex> lock(mainMutex);
+    mainTasks.push_back(std::move(task));
+    return;
+  }
+
+  Queue &queue = *queues[currentQueue()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+  queued.fetch_add(1, std::memory_order_release);
+  {
+    // Pairs with the predicate check in workerLoop so the wakeup isn't lost
+    std::lock_guard<std::mutex> lock(sleepMutex);
+  }
+  wake.notify_one();
+}
+
+void JobSystem::execute(Task &task) {
+  task.job();
+  finish(task.counter);
+}
+
+void JobSystem::finish(JobCounter *counter) {
+  if (!counter)
+    return;
+
+  std::vector<std::function<void()>> released;
+  {
+    std::lock_guard<std::mutex> lock(counter->mutex);
+    if (counter->count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      released.swap(counter->released);
+  }
+  for (std::function<void()> &release : released)
+    release();
+}
+
+int JobSystem::currentQueue() const {
+  return currentSystem == this ? currentIndex : int(queues.size()) - 1;
+}
+
+bool JobSystem::popOrSteal(int self, Task &task) {
+  // Newest of our own jobs first, it's the one most likely still in cache
+  {
+    Queue &queue = *queues[self];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      queued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  // Then the oldest job of someone else
+  int count = int(queues.size());
+  for (int i = 1; i < count; i++) {
+    Queue &queue = *queues[(self + i) % count];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      queued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+void JobSystem::workerLoop(int index) {
+  currentSystem = this;
+  currentIndex = index;
+
+  while (true) {
+    Task task;
+    if (popOrSteal(index, task)) {
+      execute(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    wake.wait(lock, [this] {
+      return stopping || queued.load(std::memory_order_acquire) > 0;
+    });
+    if (stopping)
+      return;
+  }
+}
+
+int JobSystem::drainMainThread() {
+  if (!isMainThread())
+    return 0;
+
+  std::vector<Task> tasks;
+  {
+    std::lock_guard<std::mutex> lock(mainMutex);
+    tasks.swap(mainTasks);
+  }
+  for (Task &task : tasks)
+    execute(task);
+  return int(tasks.size());
+}
+
+void JobSystem::wait(JobCounter &counter, bool drainMainQueue) {
+  int self = currentQueue();
+  while (!counter.done()) {
+    if (drainMainQueue && drainMainThread() > 0)
+      continue;
+
+    Task task;
+    if (popOrSteal(self, task)) {
+      execute(task);
+      continue;
+    }
+    std::this_thread::yield();
+  }
+
+  // The thread that brought the counter to zero may still hold its lock,
+  // make sure it's let go before the caller destroys the counter
+  std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+JobSystem &jobSystem() {
+  static JobSystem jobs;
+  return jobs;
+}
@@ -0,0 +1,111 @@
+#ifndef JOBS_HPP
+#define JOBS_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks a group of jobs. It goes up when a job is scheduled against it and
+// down when that job returns, so zero means the whole group is done. Jobs
+// can also be held back until a counter reaches zero (JobSystem::runAfter).
+class JobCounter {
+public:
+  JobCounter() = default;
+  JobCounter(const JobCounter &) = delete;
+  JobCounter &operator=(const JobCounter &) = delete;
+
+  bool done() const { return count.load(std::memory_order_acquire) == 0; }
+  int pending() const { return count.load(std::memory_order_acquire); }
+
+private:
+  friend class JobSystem;
+
+  std::atomic<int> count{0};
+  std::mutex mutex;
+  // Schedules the jobs held back on this counter
+  std::vector<std::function<void()>> released;
+};
+
+// Work-stealing job system. Every worker owns a deque: it pushes and pops
+// its own jobs at the back and, when it runs dry, steals from the front of
+// the others. Threads outside the pool share one extra deque. Work that has
+// to stay on the thread owning the GL context goes through a separate
+// main-thread queue, drained by drainMainThread() or while the main thread
+// waits on a counter.
+class JobSystem {
+public:
+  using Job = std::function<void()>;
+
+  // workerCount < 0 picks one worker per hardware thread, minus the caller.
+  // The constructing thread becomes the main thread.
+  explicit JobSystem(int workerCount = -1);
+  ~JobSystem();
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  void run(Job job, JobCounter *counter = nullptr);
+  // Holds job back until dependency reaches zero
+  void runAfter(JobCounter &dependency, Job job, JobCounter *counter = nullptr);
+  void runOnMainThread(Job job, JobCounter *counter = nullptr);
+  void runOnMainThreadAfter(JobCounter &dependency, Job job,
+                            JobCounter *counter = nullptr);
+
+  // Runs everything queued for the main thread, returns how many jobs ran.
+  // Does nothing when called from any other thread.
+  int drainMainThread();
+
+  // Helps out with jobs until counter reaches zero. On the main thread it
+  // also runs main-thread work, unless drainMainQueue is false: callers in
+  // the middle of a GL sequence pass false, since those tasks change GL
+  // state such as texture bindings.
+  void wait(JobCounter &counter, bool drainMainQueue = true);
+
+  int workerCount() const { return int(threads.size()); }
+  bool isMainThread() const { return std::this_thread::get_id() == mainThread; }
+
+private:
+  struct Task {
+    Job job;
+    JobCounter *counter = nullptr;
+    bool mainThread = false;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  Task makeTask(Job job, JobCounter *counter, bool onMainThread);
+  void runAfter(JobCounter &dependency, Task task);
+  void schedule(Task task);
+  void execute(Task &task);
+  void finish(JobCounter *counter);
+  int currentQueue() const;
+  bool popOrSteal(int self, Task &task);
+  void workerLoop(int index);
+
+  // One per worker, the last one is shared by threads outside the pool
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::thread::id mainThread;
+
+  std::mutex mainMutex;
+  std::vector<Task> mainTasks;
+
+  // Idle workers sleep here until something is queued
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  std::atomic<int> queued{0};
+  std::atomic<bool> stopping{false};
+};
+
+// Shared job system, created on first use. The thread that first calls this
+// becomes the main thread, so call it early from main().
+JobSystem &jobSystem();
+
+#endif
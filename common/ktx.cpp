@@ -0,0 +1,111 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "file_formats.hpp"
+#include "ktx.hpp"
+#include "mapped_file.hpp"
+
+struct KTXHeader {
+  uint32_t endianness;
+  uint32_t glType;
+  uint32_t glTypeSize;
+  uint32_t glFormat;
+  uint32_t glInternalFormat;
+  uint32_t glBaseInternalFormat;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t numberOfArrayElements;
+  uint32_t numberOfFaces;
+  uint32_t numberOfMipmapLevels;
+  uint32_t bytesOfKeyValueData;
+};
+
+static bool formatSupported(GLenum internalFormat) {
+  switch (internalFormat) {
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    return GLEW_EXT_texture_compression_s3tc;
+  case GL_COMPRESSED_RG_RGTC2:
+    // Core since 3.0
+    return true;
+  default:
+    return false;
+  }
+}
+
+GLuint loadKTX(const char *path, GLenum filter_mode,
+               GLenum what_happens_at_edge, int &width, int &height) {
+  MappedFile file;
+  if (!file.open(path))
+    return 0;
+
+  printf("Reading baked texture %s\n", path);
+
+  KTXHeader header;
+  if (file.size() < sizeof(ktx_identifier) + sizeof(header) ||
+      memcmp(file.data(), ktx_identifier, sizeof(ktx_identifier)) != 0) {
+    printf("Not a correct KTX file\n");
+    return 0;
+  }
+  memcpy(&header, file.data() + sizeof(ktx_identifier), sizeof(header));
+
+  if (header.endianness != 0x04030201 || header.glType != 0 ||
+      header.pixelDepth != 0 || header.numberOfFaces != 1 ||
+      header.numberOfArrayElements != 0) {
+    printf("Only little endian, compressed 2D KTX textures are supported\n");
+    return 0;
+  }
+  if (!formatSupported(header.glInternalFormat)) {
+    printf("KTX format 0x%x isn't supported by this GL\n",
+           header.glInternalFormat);
+    return 0;
+  }
+
+  GLuint textureID;
+  glGenTextures(1, &textureID);
+  glBindTexture(GL_TEXTURE_2D, textureID);
+
+  size_t pos = sizeof(ktx_identifier) + sizeof(header) + header.bytesOfKeyValueData;
+  uint32_t levels = header.numberOfMipmapLevels == 0 ? 1 : header.numberOfMipmapLevels;
+  uint32_t level = 0;
+  for (; level < levels; level++) {
+    uint32_t imageSize;
+    if (pos + 4 > file.size())
+      break;
+    memcpy(&imageSize, file.data() + pos, 4);
+    pos += 4;
+    if (pos + imageSize > file.size())
+      break;
+
+    GLsizei w = GLsizei(header.pixelWidth >> level);
+    GLsizei h = GLsizei(header.pixelHeight >> level);
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, header.glInternalFormat,
+                           w > 0 ? w : 1, h > 0 ? h : 1, 0, imageSize,
+                           file.data() + pos);
+    pos += (imageSize + 3) & ~3u;
+  }
+
+  if (level != levels) {
+    printf("KTX file %s is truncated\n", path);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDeleteTextures(1, &textureID);
+    return 0;
+  }
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, what_happens_at_edge);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, what_happens_at_edge);
+  GLenum baseFilter = filter_mode == GL_NEAREST ? GL_NEAREST : GL_LINEAR;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, baseFilter);
+  // Without a mip chain only the base level can be sampled
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  levels > 1 ? filter_mode : baseFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(levels - 1));
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  width = int(header.pixelWidth);
+  height = int(header.pixelHeight);
+  return textureID;
+}
@@ -0,0 +1,13 @@
+#ifndef KTX_HPP
+#define KTX_HPP
+
+#include <GL/glew.h>
+
+// Loads a baked, block compressed KTX 1.1 texture with its precomputed mip
+// chain. The file is memory-mapped and each level handed straight to
+// glCompressedTexImage2D. Returns 0 when the file is missing or its format
+// isn't supported here, so callers can fall back to the source image.
+GLuint loadKTX(const char *path, GLenum filter_mode,
+               GLenum what_happens_at_edge, int &width, int &height);
+
+#endif
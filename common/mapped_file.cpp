@@ -0,0 +1,115 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char *path) {
+  close();
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping) {
+    CloseHandle(file);
+    return false;
+  }
+
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  fileHandle = file;
+  mappingHandle = mapping;
+  bytes = static_cast<const unsigned char *>(view);
+  length = size_t(fileSize.QuadPart);
+  return true;
+}
+
+void MappedFile::close() {
+  if (bytes)
+    UnmapViewOfFile(bytes);
+  if (mappingHandle)
+    CloseHandle(mappingHandle);
+  if (fileHandle)
+    CloseHandle(fileHandle);
+  bytes = nullptr;
+  length = 0;
+  fileHandle = nullptr;
+  mappingHandle = nullptr;
+}
+
+void MappedFile::adviseSequential() {}
+
+void MappedFile::release(size_t, size_t) {}
+
+#else
+
+bool MappedFile::open(const char *path) {
+  close();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void *view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file
+  ::close(fd);
+  if (view == MAP_FAILED)
+    return false;
+
+  bytes = static_cast<const unsigned char *>(view);
+  length = size_t(info.st_size);
+  return true;
+}
+
+void MappedFile::close() {
+  if (bytes)
+    munmap(const_cast<unsigned char *>(bytes), length);
+  bytes = nullptr;
+  length = 0;
+}
+
+void MappedFile::adviseSequential() {
+  if (bytes)
+    madvise(const_cast<unsigned char *>(bytes), length, MADV_SEQUENTIAL);
+}
+
+void MappedFile::release(size_t offset, size_t count) {
+  if (!bytes || offset >= length)
+    return;
+  // madvise wants page aligned ranges, only drop whole pages inside the range
+  size_t page = size_t(sysconf(_SC_PAGESIZE));
+  size_t begin = (offset + page - 1) / page * page;
+  size_t end = (offset + count < length ? offset + count : length) / page * page;
+  if (end > begin)
+    madvise(const_cast<unsigned char *>(bytes) + begin, end - begin, MADV_DONTNEED);
+}
+
+#endif
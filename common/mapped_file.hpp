@@ -0,0 +1,37 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. Pages are only brought in as they
+// are touched, so files larger than physical memory can be walked through as
+// long as the caller releases the parts it is done with.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const char *path);
+  void close();
+
+  const unsigned char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+  // Hint that the file will be read front to back
+  void adviseSequential();
+  // Drop the pages covering [offset, offset + count), they can be read back
+  // from the file if touched again
+  void release(size_t offset, size_t count);
+
+private:
+  const unsigned char *bytes = nullptr;
+  size_t length = 0;
+#ifdef _WIN32
+  void *fileHandle = nullptr;
+  void *mappingHandle = nullptr;
+#endif
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "pacing.hpp"
+
+#include <GLFW/glfw3.h>
+
+// Time the input sample is placed before the predicted deadline, to absorb
+// sleep overshoot and frame to frame variance
+static const double deadline_margin = 0.002;
+// Slots when not throttling, enough for query results to come back before
+// their slot is reused
+static const int unthrottled_slots = 3;
+
+FramePacer::FramePacer(int swapInterval, int maxFramesInFlight, bool lateInput)
+    : swapInterval(swapInterval), maxFramesInFlight(std::max(0, maxFramesInFlight)),
+      lateInput(lateInput) {}
+
+void FramePacer::setup() {
+  // Unconfigured, the pacer stays out of the frame entirely
+  if (!isConfigured())
+    return;
+  if (swapInterval >= 0)
+    glfwSwapInterval(swapInterval);
+
+  frames.resize(maxFramesInFlight > 0 ? maxFramesInFlight : unthrottled_slots);
+  for (Frame &frame : frames)
+    glGenQueries(1, &frame.timestampQuery);
+
+  const GLFWvidmode *videoMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+  if (videoMode && videoMode->refreshRate > 0)
+    refreshPeriod = 1.0 / videoMode->refreshRate;
+
+  printf("Frame pacing: swap interval %s, %s frames in flight%s\n",
+         swapInterval >= 0 ? std::to_string(swapInterval).c_str() : "default",
+         maxFramesInFlight > 0 ? std::to_string(maxFramesInFlight).c_str()
+                               : "unlimited",
+         lateInput ? ", late input sampling" : "");
+}
+
+void FramePacer::unload() {
+  for (Frame &frame : frames) {
+    if (frame.fence)
+      glDeleteSync(frame.fence);
+    glDeleteQueries(1, &frame.timestampQuery);
+  }
+  frames.clear();
+}
+
+void FramePacer::retire(int slot) {
+  Frame &frame = frames[slot];
+
+  if (frame.fence) {
+    double start = glfwGetTime();
+    // The first wait flushes, so the fence can't be stuck in the queue
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(frame.fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+      flags = 0;
+    glDeleteSync(frame.fence);
+    frame.fence = 0;
+    waitSum += (glfwGetTime() - start) * 1000.0;
+    waitSamples++;
+  }
+
+  if (frame.inputSampleTime <= 0.0)
+    return;
+  // Without a fence the result may not be in yet, that frame goes uncounted
+  GLuint available = GL_FALSE;
+  glGetQueryObjectuiv(frame.timestampQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (available) {
+    GLuint64 gpuDone = 0;
+    glGetQueryObjectui64v(frame.timestampQuery, GL_QUERY_RESULT, &gpuDone);
+    double latency =
+        std::max(0.0, gpuDone * 1e-9 + gpuToCpuOffset - frame.inputSampleTime);
+    predictedWork =
+        predictedWork > 0.0 ? 0.9 * predictedWork + 0.1 * latency : latency;
+    latencySum += latency * 1000.0;
+    maxLatencyMs = std::max(maxLatencyMs, latency * 1000.0);
+    latencySamples++;
+  }
+  frame.inputSampleTime = 0.0;
+}
+
+double FramePacer::beginFrame() {
+  if (!isConfigured())
+    return 0.0;
+
+  // The clocks drift apart, so line them up again every frame
+  GLint64 gpuNow = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+  gpuToCpuOffset = glfwGetTime() - gpuNow * 1e-9;
+
+  retire(int(frameIndex % frames.size()));
+
+  // Only with vsync is there a deadline to aim for. The next one is
+  // guessed from when the last swap returned, which is exact once the
+  // fences keep the driver from queueing frames.
+  if (!lateInput || swapInterval < 1 || refreshPeriod <= 0.0 ||
+      lastSwapTime <= 0.0)
+    return 0.0;
+  double nextVsync = lastSwapTime + refreshPeriod * swapInterval;
+  double deadline = nextVsync - predictedWork - deadline_margin;
+  return deadline > glfwGetTime() ? deadline : 0.0;
+}
+
+void FramePacer::endFrame(double inputSampleTime) {
+  if (!isConfigured())
+    return;
+  Frame &frame = frames[frameIndex % frames.size()];
+  glQueryCounter(frame.timestampQuery, GL_TIMESTAMP);
+  frame.inputSampleTime = inputSampleTime;
+  if (maxFramesInFlight > 0)
+    frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  frameIndex++;
+}
+
+void FramePacer::markSwap() { lastSwapTime = glfwGetTime(); }
+
+double FramePacer::getMeanLatencyMs() const {
+  return latencySamples > 0 ? latencySum / latencySamples : 0.0;
+}
+
+double FramePacer::getMeanWaitMs() const {
+  return waitSamples > 0 ? waitSum / waitSamples : 0.0;
+}
+
+void FramePacer::resetStats() {
+  latencySum = 0.0;
+  maxLatencyMs = 0.0;
+  latencySamples = 0;
+  waitSum = 0.0;
+  waitSamples = 0;
+}
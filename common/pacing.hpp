@@ -0,0 +1,79 @@
+#ifndef PACING_HPP
+#define PACING_HPP
+
+#include <vector>
+
+#include <GL/glew.h>
+
+// Frame pacing for latency over throughput. A ring of fences keeps the CPU
+// at most maxFramesInFlight frames ahead of the GPU, and with lateInput the
+// input sample is pushed back to the last moment that should still make
+// the next vsync. Every frame's latency, from input sample to the GPU
+// finishing its commands, is measured with timestamp queries.
+//
+// Per frame: beginFrame, sample input, render, endFrame, swap, markSwap.
+class FramePacer {
+public:
+  // swapInterval < 0 keeps the driver's default, maxFramesInFlight 0
+  // doesn't throttle
+  FramePacer(int swapInterval, int maxFramesInFlight, bool lateInput);
+
+  // Needs a current GL context. Does nothing unless isConfigured, and
+  // neither do the per frame calls then.
+  void setup();
+  void unload();
+
+  // Waits for the GPU to retire the frame maxFramesInFlight back and
+  // collects its latency. Returns when input should be sampled, or 0 for
+  // right away.
+  double beginFrame();
+  // After the frame's last GL command, before the swap
+  void endFrame(double inputSampleTime);
+  // Right after the swap returns
+  void markSwap();
+
+  // Over the frames retired since the last resetStats
+  double getMeanLatencyMs() const;
+  double getMaxLatencyMs() const { return maxLatencyMs; }
+  // CPU time spent blocked on fences per frame
+  double getMeanWaitMs() const;
+  void resetStats();
+
+  // False when every setting is left at its default
+  bool isConfigured() const {
+    return swapInterval >= 0 || maxFramesInFlight > 0 || lateInput;
+  }
+  int getSwapInterval() const { return swapInterval; }
+  int getMaxFramesInFlight() const { return maxFramesInFlight; }
+
+private:
+  void retire(int slot);
+
+  struct Frame {
+    GLsync fence = 0;
+    GLuint timestampQuery = 0;
+    double inputSampleTime = 0.0;
+  };
+
+  int swapInterval;
+  int maxFramesInFlight;
+  bool lateInput;
+  // maxFramesInFlight slots, reusing one means waiting for its frame
+  std::vector<Frame> frames;
+  long frameIndex = 0;
+
+  // GPU timestamps are converted to glfwGetTime seconds with this
+  double gpuToCpuOffset = 0.0;
+  double refreshPeriod = 0.0;
+  double lastSwapTime = 0.0;
+  // Input sample to GPU done, smoothed, the work the deadline has to fit
+  double predictedWork = 0.0;
+
+  double latencySum = 0.0;
+  double maxLatencyMs = 0.0;
+  int latencySamples = 0;
+  double waitSum = 0.0;
+  int waitSamples = 0;
+};
+
+#endif
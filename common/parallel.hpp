@@ -0,0 +1,29 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+
+#include "jobs.hpp"
+
+// Runs fn(begin, end) over [0, count) on the shared job system. The range is
+// cut into a few chunks per thread so stealing can even out the load, and
+// the caller works through jobs until every chunk is done. Main-thread work
+// is left queued, so fn's caller can keep GL state across the loop.
+template <typename Fn>
+void parallelFor(int count, const Fn &fn) {
+  if (count <= 0)
+    return;
+  JobSystem &jobs = jobSystem();
+  int chunks = std::min(count, (jobs.workerCount() + 1) * 4);
+  int chunk = (count + chunks - 1) / chunks;
+
+  JobCounter counter;
+  for (int begin = chunk; begin < count; begin += chunk) {
+    int end = std::min(count, begin + chunk);
+    jobs.run([&fn, begin, end] { fn(begin, end); }, &counter);
+  }
+  fn(0, std::min(count, chunk));
+  jobs.wait(counter, false);
+}
+
+#endif
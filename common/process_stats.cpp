@@ -0,0 +1,30 @@
+#include "process_stats.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+
+size_t peakResidentBytes() {
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.PeakWorkingSetSize;
+}
+
+#else
+#include <sys/resource.h>
+
+size_t peakResidentBytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return size_t(usage.ru_maxrss);
+#else
+  // Linux reports kilobytes
+  return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+#endif
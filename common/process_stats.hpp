@@ -0,0 +1,9 @@
+#ifndef PROCESS_STATS_HPP
+#define PROCESS_STATS_HPP
+
+#include <cstddef>
+
+// Highest resident set size of the process so far, in bytes (0 if unknown)
+size_t peakResidentBytes();
+
+#endif
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "regress.hpp"
+
+bool writePPM(const char *path, int width, int height,
+              const std::vector<uint8_t> &rgb) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    printf("Could not write %s\n", path);
+    return false;
+  }
+  fprintf(file, "P6\n%d %d\n255\n", width, height);
+  bool ok = fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+  fclose(file);
+  return ok;
+}
+
+bool readPPM(const char *path, int &width, int &height,
+             std::vector<uint8_t> &rgb) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+  int maxValue = 0;
+  // The single whitespace byte after the header is eaten by the last %*c
+  if (fscanf(file, "P6 %d %d %d%*c", &width, &height, &maxValue) != 3 ||
+      maxValue != 255 || width <= 0 || height <= 0) {
+    printf("%s is not an 8 bit binary PPM\n", path);
+    fclose(file);
+    return false;
+  }
+  rgb.resize(size_t(width) * height * 3);
+  bool ok = fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+  fclose(file);
+  return ok;
+}
+
+// sRGB byte to CIELAB, D65 white
+static void toLab(const uint8_t *rgb, double lab[3]) {
+  double linear[3];
+  for (int c = 0; c < 3; c++) {
+    double v = rgb[c] / 255.0;
+    linear[c] = v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+  }
+  double xyz[3] = {
+      (0.4124 * linear[0] + 0.3576 * linear[1] + 0.1805 * linear[2]) / 0.95047,
+      0.2126 * linear[0] + 0.7152 * linear[1] + 0.0722 * linear[2],
+      (0.0193 * linear[0] + 0.1192 * linear[1] + 0.9505 * linear[2]) / 1.08883};
+  for (int c = 0; c < 3; c++)
+    xyz[c] = xyz[c] > 0.008856 ? std::cbrt(xyz[c]) : 7.787 * xyz[c] + 16.0 / 116.0;
+  lab[0] = 116.0 * xyz[1] - 16.0;
+  lab[1] = 500.0 * (xyz[0] - xyz[1]);
+  lab[2] = 200.0 * (xyz[1] - xyz[2]);
+}
+
+ImageDiff compareImages(const std::vector<uint8_t> &a,
+                        const std::vector<uint8_t> &b, int width, int height,
+                        double visibleDeltaE) {
+  ImageDiff diff;
+  size_t pixels = size_t(width) * height;
+  if (pixels == 0)
+    return diff;
+
+  size_t different = 0;
+  double total = 0.0;
+  for (size_t i = 0; i < pixels; i++) {
+    const uint8_t *pa = &a[i * 3];
+    const uint8_t *pb = &b[i * 3];
+    if (pa[0] == pb[0] && pa[1] == pb[1] && pa[2] == pb[2])
+      continue;
+    double labA[3], labB[3];
+    toLab(pa, labA);
+    toLab(pb, labB);
+    double deltaE = std::sqrt((labA[0] - labB[0]) * (labA[0] - labB[0]) +
+                              (labA[1] - labB[1]) * (labA[1] - labB[1]) +
+                              (labA[2] - labB[2]) * (labA[2] - labB[2]));
+    total += deltaE;
+    diff.maxDeltaE = std::max(diff.maxDeltaE, deltaE);
+    if (deltaE > visibleDeltaE)
+      different++;
+  }
+  diff.meanDeltaE = total / pixels;
+  diff.differentFraction = double(different) / pixels;
+  return diff;
+}
+
+bool Baseline::load(const char *path) {
+  std::ifstream file(path);
+  if (!file.is_open())
+    return false;
+
+  std::string text;
+  while (std::getline(file, text)) {
+    std::istringstream line(text);
+    std::string key;
+    double value;
+    if (!(line >> key) || key[0] == '#')
+      continue;
+    if (line >> value)
+      values[key] = value;
+  }
+  return true;
+}
+
+bool Baseline::save(const char *path) const {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    printf("Could not write %s\n", path);
+    return false;
+  }
+  for (const auto &entry : values)
+    fprintf(file, "%s %.6g\n", entry.first.c_str(), entry.second);
+  fclose(file);
+  return true;
+}
+
+double Baseline::get(const std::string &key, double fallback) const {
+  auto it = values.find(key);
+  return it == values.end() ? fallback : it->second;
+}
@@ -0,0 +1,45 @@
+#ifndef REGRESS_HPP
+#define REGRESS_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Golden images and performance baselines for the renderer's -regress mode
+
+// Binary PPM (P6), rows top to bottom
+bool writePPM(const char *path, int width, int height,
+              const std::vector<uint8_t> &rgb);
+bool readPPM(const char *path, int &width, int &height,
+             std::vector<uint8_t> &rgb);
+
+struct ImageDiff {
+  double meanDeltaE = 0.0;
+  double maxDeltaE = 0.0;
+  // Share of pixels whose difference is plainly visible
+  double differentFraction = 0.0;
+};
+
+// Per pixel CIE76 colour difference in CIELAB, where a delta E of about 2.3
+// is just noticeable. Pixels above visibleDeltaE count as different.
+ImageDiff compareImages(const std::vector<uint8_t> &a,
+                        const std::vector<uint8_t> &b, int width, int height,
+                        double visibleDeltaE = 10.0);
+
+// Named measurements and thresholds, stored one "key value" per line so a
+// diff of the file shows what changed
+class Baseline {
+public:
+  bool load(const char *path);
+  bool save(const char *path) const;
+
+  bool has(const std::string &key) const { return values.count(key) != 0; }
+  double get(const std::string &key, double fallback) const;
+  void set(const std::string &key, double value) { values[key] = value; }
+
+private:
+  std::map<std::string, double> values;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include <algorithm>
+#include <cmath>
+
+#include "resolution.hpp"
+
+// How much of each new sample goes into the running average
+static const double smoothing = 0.1;
+// Don't react to errors smaller than this fraction of the target
+static const double deadband = 0.05;
+// Largest relative change of the scale in a single frame
+static const float maxStep = 0.05f;
+
+ResolutionController::ResolutionController(float minScale, float maxScale,
+                                           float targetMs)
+    : minScale(std::min(minScale, maxScale)),
+      maxScale(std::max(minScale, maxScale)),
+      targetMs(targetMs),
+      scale(std::max(minScale, maxScale)) {}
+
+float ResolutionController::update(double gpuMs) {
+  if (gpuMs <= 0.0)
+    return scale;
+
+  if (smoothedMs == 0.0)
+    smoothedMs = gpuMs;
+  else
+    smoothedMs += (gpuMs - smoothedMs) * smoothing;
+
+  double error = smoothedMs / targetMs - 1.0;
+  if (std::abs(error) < deadband)
+    return scale;
+
+  // Cost goes with the pixel count, so the ideal scale is sqrt(target/actual)
+  float ideal = scale * float(std::sqrt(targetMs / smoothedMs));
+  float step = std::clamp(ideal / scale, 1.0f - maxStep, 1.0f + maxStep);
+  scale = std::clamp(scale * step, minScale, maxScale);
+  return scale;
+}
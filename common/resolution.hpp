@@ -0,0 +1,28 @@
+#ifndef RESOLUTION_HPP
+#define RESOLUTION_HPP
+
+// Picks a render resolution scale each frame so the measured GPU frame time
+// tracks a target. The scale applies to both axes, so the shaded pixel count
+// (and roughly the fragment cost) goes with scale^2.
+class ResolutionController {
+public:
+  ResolutionController(float minScale, float maxScale, float targetMs);
+
+  // Feed the latest GPU frame time, returns the scale for the next frame
+  float update(double gpuMs);
+
+  float getScale() const { return scale; }
+  float getMinScale() const { return minScale; }
+  float getMaxScale() const { return maxScale; }
+  float getTargetMs() const { return targetMs; }
+  double getSmoothedMs() const { return smoothedMs; }
+
+private:
+  float minScale;
+  float maxScale;
+  float targetMs;
+  float scale;
+  double smoothedMs = 0.0;
+};
+
+#endif
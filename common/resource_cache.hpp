@@ -0,0 +1,63 @@
+#ifndef RESOURCE_CACHE_HPP
+#define RESOURCE_CACHE_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Reference counted resources keyed by path, so every asset is loaded once
+// however many things use it. Acquire and release from the main thread; the
+// caller that gets created == true is the one that starts the load.
+template <typename T>
+class ResourceCache {
+public:
+  // Returns the resource for key, created tells whether it was new. The
+  // reference stays valid until the last release.
+  T &acquire(const std::string &key, bool &created) {
+    auto it = entries.find(key);
+    created = it == entries.end();
+    if (created) {
+      it = entries.emplace(key, std::unique_ptr<Entry>(new Entry)).first;
+      misses++;
+    } else {
+      hits++;
+    }
+    it->second->references++;
+    return it->second->value;
+  }
+
+  // Drops a reference, destroy runs when it was the last one
+  void release(const std::string &key, const std::function<void(T &)> &destroy) {
+    auto it = entries.find(key);
+    if (it == entries.end())
+      return;
+    if (--it->second->references == 0) {
+      destroy(it->second->value);
+      entries.erase(it);
+    }
+  }
+
+  // Null when nothing holds key
+  T *find(const std::string &key) {
+    auto it = entries.find(key);
+    return it == entries.end() ? nullptr : &it->second->value;
+  }
+
+  size_t size() const { return entries.size(); }
+  // Acquires that found the resource already there
+  long getHits() const { return hits; }
+  long getMisses() const { return misses; }
+
+private:
+  struct Entry {
+    T value;
+    int references = 0;
+  };
+
+  std::unordered_map<std::string, std::unique_ptr<Entry>> entries;
+  long hits = 0;
+  long misses = 0;
+};
+
+#endif
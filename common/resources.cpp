@@ -0,0 +1,419 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "resources.hpp"
+
+static const double MB = 1048576.0;
+
+static const char *kindName(ResourceKind kind) {
+  switch (kind) {
+  case ResourceKind::Texture:
+    return "texture";
+  case ResourceKind::Buffer:
+    return "buffer";
+  case ResourceKind::Renderbuffer:
+    return "renderbuffer";
+  case ResourceKind::HostMemory:
+    return "host";
+  }
+  return "?";
+}
+
+static const char *formatName(GLenum format) {
+  switch (format) {
+  case 0:
+    return "";
+  case GL_R8:
+    return "R8";
+  case GL_R16:
+    return "R16";
+  case GL_R32F:
+    return "R32F";
+  case GL_RG8:
+    return "RG8";
+  case GL_RGB:
+  case GL_RGB8:
+    return "RGB8";
+  case GL_RGBA:
+  case GL_RGBA8:
+    return "RGBA8";
+  case GL_SRGB8:
+    return "SRGB8";
+  case GL_SRGB8_ALPHA8:
+    return "SRGB8_A8";
+  case GL_RGBA16F:
+    return "RGBA16F";
+  case GL_RGBA32F:
+    return "RGBA32F";
+  case GL_DEPTH_COMPONENT24:
+    return "DEPTH24";
+  case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    return "BC1";
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    return "BC3";
+  case GL_COMPRESSED_RG_RGTC2:
+    return "BC5";
+  }
+  return "other";
+}
+
+// Uncompressed storage per texel, three channel formats padded to four the
+// way drivers store them
+static size_t bytesPerTexel(GLenum format) {
+  switch (format) {
+  case GL_R8:
+    return 1;
+  case GL_R16:
+  case GL_RG8:
+    return 2;
+  case GL_RGBA16F:
+    return 8;
+  case GL_RGBA32F:
+    return 16;
+  default:
+    return 4;
+  }
+}
+
+// Unsized GL_RGB and GL_RGBA get 8 bit storage, and some drivers (llvmpipe)
+// report them back unsized
+static bool isEightBit(GLenum format) {
+  return format == GL_R8 || format == GL_RG8 || format == GL_RGB8 ||
+         format == GL_RGBA8 || format == GL_SRGB8 || format == GL_SRGB8_ALPHA8 ||
+         format == GL_RGB || format == GL_RGBA;
+}
+
+void ResourceRegistry::track(const Resource &resource) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Key key(resource.kind, resource.id);
+  auto it = gpuResources.find(key);
+  if (it != gpuResources.end())
+    gpuBytes -= it->second.bytes;
+  gpuResources[key] = resource;
+  gpuBytes += resource.bytes;
+  peakGpuBytes = std::max(peakGpuBytes, gpuBytes);
+}
+
+void ResourceRegistry::untrack(ResourceKind kind, GLuint id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = gpuResources.find(Key(kind, id));
+  if (it == gpuResources.end())
+    return;
+  gpuBytes -= it->second.bytes;
+  gpuResources.erase(it);
+}
+
+void ResourceRegistry::trackTexture(GLuint id, const std::string &owner,
+                                    const std::string &name) {
+  if (id == 0)
+    return;
+  Resource resource;
+  resource.kind = ResourceKind::Texture;
+  resource.id = id;
+  resource.owner = owner;
+  resource.name = name;
+
+  // Leave the binding of the active unit as the caller had it
+  GLint bound = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+  glBindTexture(GL_TEXTURE_2D, id);
+  for (int level = 0; level < 16; level++) {
+    GLint width = 0, height = 0, compressed = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+    if (width == 0)
+      break;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+    if (level == 0) {
+      GLint format = 0;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+      resource.format = GLenum(format);
+      resource.width = width;
+      resource.height = height;
+    }
+    if (compressed) {
+      GLint size = 0;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, level,
+                               GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+      resource.bytes += size_t(size);
+    } else {
+      resource.bytes += size_t(width) * height * bytesPerTexel(resource.format);
+    }
+    resource.levels++;
+  }
+  glBindTexture(GL_TEXTURE_2D, GLuint(bound));
+  track(resource);
+}
+
+void ResourceRegistry::trackBuffer(GLuint id, const std::string &owner,
+                                   const std::string &name, size_t bytes) {
+  if (id == 0)
+    return;
+  Resource resource;
+  resource.kind = ResourceKind::Buffer;
+  resource.id = id;
+  resource.owner = owner;
+  resource.name = name;
+  resource.bytes = bytes;
+  track(resource);
+}
+
+void ResourceRegistry::trackRenderbuffer(GLuint id, const std::string &owner,
+                                         const std::string &name, GLenum format,
+                                         int width, int height) {
+  if (id == 0)
+    return;
+  Resource resource;
+  resource.kind = ResourceKind::Renderbuffer;
+  resource.id = id;
+  resource.owner = owner;
+  resource.name = name;
+  resource.format = format;
+  resource.width = width;
+  resource.height = height;
+  resource.levels = 1;
+  resource.bytes = size_t(width) * height * bytesPerTexel(format);
+  track(resource);
+}
+
+void ResourceRegistry::untrackTexture(GLuint id) {
+  untrack(ResourceKind::Texture, id);
+}
+
+void ResourceRegistry::untrackBuffer(GLuint id) {
+  untrack(ResourceKind::Buffer, id);
+}
+
+void ResourceRegistry::untrackRenderbuffer(GLuint id) {
+  untrack(ResourceKind::Renderbuffer, id);
+}
+
+void ResourceRegistry::trackHost(const std::string &owner,
+                                 const std::string &name, size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::string key = owner + "/" + name;
+  auto it = hostResources.find(key);
+  if (it != hostResources.end()) {
+    hostBytes -= it->second.bytes;
+    hostResources.erase(it);
+  }
+  if (bytes == 0)
+    return;
+
+  Resource &resource = hostResources[key];
+  resource.owner = owner;
+  resource.name = name;
+  resource.bytes = bytes;
+  hostBytes += bytes;
+  peakHostBytes = std::max(peakHostBytes, hostBytes);
+}
+
+void ResourceRegistry::addStaging(const std::string &owner, size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  stagingByOwner[owner] += bytes;
+  stagingBytes += bytes;
+  peakStagingBytes = std::max(peakStagingBytes, stagingBytes);
+}
+
+void ResourceRegistry::removeStaging(const std::string &owner, size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  stagingByOwner[owner] -= bytes;
+  stagingBytes -= bytes;
+}
+
+size_t ResourceRegistry::getGpuBytes() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return gpuBytes;
+}
+
+size_t ResourceRegistry::getHostBytes() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return hostBytes + stagingBytes;
+}
+
+size_t ResourceRegistry::getPeakGpuBytes() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return peakGpuBytes;
+}
+
+size_t ResourceRegistry::getPeakStagingBytes() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return peakStagingBytes;
+}
+
+Resource ResourceRegistry::largestMipmappedTexture(const std::string &owner) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  const Resource *largest = nullptr;
+  for (const auto &entry : gpuResources) {
+    const Resource &resource = entry.second;
+    if (resource.kind != ResourceKind::Texture || resource.owner != owner ||
+        resource.levels < 2)
+      continue;
+    if (!largest || resource.bytes > largest->bytes)
+      largest = &resource;
+  }
+  return largest ? *largest : Resource();
+}
+
+GLuint ResourceRegistry::dropTopMip(GLuint id) {
+  Resource old;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = gpuResources.find(Key(ResourceKind::Texture, id));
+    if (it == gpuResources.end() || it->second.levels < 2)
+      return id;
+    old = it->second;
+  }
+
+  GLint bound = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+  glBindTexture(GL_TEXTURE_2D, id);
+  GLint compressed = 0;
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+  if (!compressed && !isEightBit(old.format)) {
+    glBindTexture(GL_TEXTURE_2D, GLuint(bound));
+    return id;
+  }
+
+  GLint minFilter, magFilter, wrapS, wrapT;
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minFilter);
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &magFilter);
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, &wrapS);
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, &wrapT);
+  GLfloat anisotropy = 1.0f;
+  if (GLEW_EXT_texture_filter_anisotropic)
+    glGetTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, &anisotropy);
+
+  // Read back everything below the top level. 8 bit formats go through
+  // RGBA8, which loses nothing.
+  struct Level {
+    GLint width, height, size;
+    std::vector<uint8_t> data;
+  };
+  std::vector<Level> levels(old.levels - 1);
+  GLint packAlignment = 4;
+  glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  for (int i = 0; i < old.levels - 1; i++) {
+    Level &level = levels[i];
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, i + 1, GL_TEXTURE_WIDTH, &level.width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, i + 1, GL_TEXTURE_HEIGHT, &level.height);
+    if (compressed) {
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, i + 1,
+                               GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &level.size);
+      level.data.resize(level.size);
+      glGetCompressedTexImage(GL_TEXTURE_2D, i + 1, level.data.data());
+    } else {
+      level.size = level.width * level.height * 4;
+      level.data.resize(level.size);
+      glGetTexImage(GL_TEXTURE_2D, i + 1, GL_RGBA, GL_UNSIGNED_BYTE, level.data.data());
+    }
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+
+  GLuint textureID;
+  glGenTextures(1, &textureID);
+  glBindTexture(GL_TEXTURE_2D, textureID);
+  for (int i = 0; i < int(levels.size()); i++) {
+    const Level &level = levels[i];
+    if (compressed)
+      glCompressedTexImage2D(GL_TEXTURE_2D, i, old.format, level.width,
+                             level.height, 0, level.size, level.data.data());
+    else
+      glTexImage2D(GL_TEXTURE_2D, i, old.format, level.width, level.height, 0,
+                   GL_RGBA, GL_UNSIGNED_BYTE, level.data.data());
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(levels.size()) - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+  if (anisotropy > 1.0f)
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
+  // If the caller had the old texture bound, it gets the new one
+  glBindTexture(GL_TEXTURE_2D, GLuint(bound) == id ? textureID : GLuint(bound));
+
+  glDeleteTextures(1, &id);
+  untrackTexture(id);
+  trackTexture(textureID, old.owner, old.name);
+  return textureID;
+}
+
+static void printResource(const Resource &resource) {
+  printf("  %9.2f MB  %-12s %-12s %-8s", resource.bytes / MB,
+         resource.owner.c_str(), kindName(resource.kind),
+         formatName(resource.format));
+  if (resource.width > 0)
+    printf(" %5dx%-5d %2d levels", resource.width, resource.height,
+           resource.levels);
+  printf("  %s\n", resource.name.c_str());
+}
+
+void ResourceRegistry::printSummary(int topN) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  printf("Memory: GPU %.1f MB (peak %.1f), CPU %.1f MB (peak %.1f), "
+         "staging %.1f MB (peak %.1f)\n",
+         gpuBytes / MB, peakGpuBytes / MB, hostBytes / MB, peakHostBytes / MB,
+         stagingBytes / MB, peakStagingBytes / MB);
+
+  struct Total {
+    int count = 0;
+    size_t bytes = 0;
+  };
+  std::map<std::pair<std::string, ResourceKind>, Total> totals;
+  std::vector<const Resource *> all;
+  for (const auto &entry : gpuResources)
+    all.push_back(&entry.second);
+  for (const auto &entry : hostResources)
+    all.push_back(&entry.second);
+  for (const Resource *resource : all) {
+    Total &total = totals[std::make_pair(resource->owner, resource->kind)];
+    total.count++;
+    total.bytes += resource->bytes;
+  }
+  for (const auto &entry : totals)
+    printf("  %-12s %-12s %5d objects %9.2f MB\n", entry.first.first.c_str(),
+           kindName(entry.first.second), entry.second.count,
+           entry.second.bytes / MB);
+  for (const auto &entry : stagingByOwner)
+    if (entry.second != 0)
+      printf("  %-12s %-12s %9.2f MB waiting for upload\n", entry.first.c_str(),
+             "staging", entry.second / MB);
+
+  size_t shown = std::min(all.size(), size_t(std::max(0, topN)));
+  std::partial_sort(all.begin(), all.begin() + shown, all.end(),
+                    [](const Resource *a, const Resource *b) {
+                      return a->bytes > b->bytes;
+                    });
+  printf("Largest %zu:\n", shown);
+  for (size_t i = 0; i < shown; i++)
+    printResource(*all[i]);
+}
+
+void ResourceRegistry::printReport() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  printf("Memory report: peak GPU %.1f MB, peak CPU %.1f MB, peak staging "
+         "%.1f MB\n",
+         peakGpuBytes / MB, peakHostBytes / MB, peakStagingBytes / MB);
+  size_t leaked = gpuResources.size() + hostResources.size();
+  if (leaked == 0 && stagingBytes == 0) {
+    printf("No leaks, every resource was released\n");
+    return;
+  }
+  printf("%zu resources (%.2f MB) were never released:\n", leaked,
+         (gpuBytes + hostBytes) / MB);
+  for (const auto &entry : gpuResources)
+    printResource(entry.second);
+  for (const auto &entry : hostResources)
+    printResource(entry.second);
+  if (stagingBytes != 0)
+    printf("  %9.2f MB  staging never uploaded\n", stagingBytes / MB);
+}
+
+ResourceRegistry &resources() {
+  static ResourceRegistry registry;
+  return registry;
+}
@@ -0,0 +1,92 @@
+#ifndef RESOURCES_HPP
+#define RESOURCES_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <GL/glew.h>
+
+enum class ResourceKind { Texture, Buffer, Renderbuffer, HostMemory };
+
+struct Resource {
+  ResourceKind kind = ResourceKind::HostMemory;
+  // 0 for host memory
+  GLuint id = 0;
+  // Subsystem that created it, e.g. "materials" or "terrain"
+  std::string owner;
+  std::string name;
+  GLenum format = 0;
+  int width = 0;
+  int height = 0;
+  int levels = 0;
+  size_t bytes = 0;
+};
+
+// Every GPU object and long lived CPU allocation of the renderer, with its
+// size, format and owner, so memory use can be reported and budgeted.
+// Register right after creating an object and unregister right before
+// deleting it; whatever is still registered at exit has leaked.
+class ResourceRegistry {
+public:
+  // Sizes the texture from GL's own level parameters, so the count is right
+  // whatever format and mip chain the loader chose. The GL_TEXTURE_2D
+  // binding is restored afterwards.
+  void trackTexture(GLuint id, const std::string &owner,
+                    const std::string &name);
+  // Also updates the size of a buffer that's already tracked
+  void trackBuffer(GLuint id, const std::string &owner, const std::string &name,
+                   size_t bytes);
+  void trackRenderbuffer(GLuint id, const std::string &owner,
+                         const std::string &name, GLenum format, int width,
+                         int height);
+  void untrackTexture(GLuint id);
+  void untrackBuffer(GLuint id);
+  void untrackRenderbuffer(GLuint id);
+
+  // CPU copies that live on after loading, 0 bytes forgets them
+  void trackHost(const std::string &owner, const std::string &name,
+                 size_t bytes);
+  // Decoded data waiting for its upload. Safe from any thread.
+  void addStaging(const std::string &owner, size_t bytes);
+  void removeStaging(const std::string &owner, size_t bytes);
+
+  size_t getGpuBytes() const;
+  size_t getHostBytes() const;
+  size_t getPeakGpuBytes() const;
+  size_t getPeakStagingBytes() const;
+
+  // Largest texture of owner that still has a mip level below its top one,
+  // id 0 when there's none
+  Resource largestMipmappedTexture(const std::string &owner) const;
+  // Re-creates an 8 bit or block compressed texture without its top level,
+  // keeping its filtering, wrapping and anisotropy, and returns the new id.
+  // The old id is deleted, so the caller has to swap every copy it holds.
+  GLuint dropTopMip(GLuint id);
+
+  // Totals per owner and kind, then the topN largest objects
+  void printSummary(int topN) const;
+  // Peaks and anything still registered, meant for exit after unloading
+  void printReport() const;
+
+private:
+  typedef std::pair<ResourceKind, GLuint> Key;
+  void track(const Resource &resource);
+  void untrack(ResourceKind kind, GLuint id);
+
+  mutable std::mutex mutex;
+  std::map<Key, Resource> gpuResources;
+  std::map<std::string, Resource> hostResources;
+  std::map<std::string, size_t> stagingByOwner;
+  size_t gpuBytes = 0;
+  size_t hostBytes = 0;
+  size_t stagingBytes = 0;
+  size_t peakGpuBytes = 0;
+  size_t peakHostBytes = 0;
+  size_t peakStagingBytes = 0;
+};
+
+ResourceRegistry &resources();
+
+#endif
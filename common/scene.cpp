@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "scene.hpp"
+
+enum class Block { None, Terrain, Mesh };
+
+static bool readVec3(std::istringstream &line, glm::vec3 &out) {
+  float x, y, z;
+  if (!(line >> x))
+    return false;
+  // A single value means the same on every axis
+  if (!(line >> y >> z))
+    y = z = x;
+  out = glm::vec3(x, y, z);
+  return true;
+}
+
+bool loadSceneFile(const char *path, Scene &scene) {
+  printf("Loading scene file %s...\n", path);
+
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    printf("Impossible to open the file ! Are you in the right path ?\n");
+    return false;
+  }
+
+  Block block = Block::None;
+  TerrainParams &terrain = scene.terrainParams;
+  std::string text;
+  int lineNumber = 0;
+  while (std::getline(file, text)) {
+    lineNumber++;
+    std::istringstream line(text);
+    std::string key;
+    // Blank lines and comments
+    if (!(line >> key) || key[0] == '#')
+      continue;
+
+    bool ok = true;
+    if (key == "terrain") {
+      block = Block::Terrain;
+      scene.terrain = true;
+    } else if (key == "noterrain") {
+      block = Block::None;
+      scene.terrain = false;
+    } else if (key == "mesh") {
+      block = Block::Mesh;
+      scene.meshes.emplace_back();
+      ok = bool(line >> scene.meshes.back().objPath);
+    } else if (block == Block::Terrain && key == "heightmap") {
+      ok = bool(line >> terrain.heightMapPath);
+      // Optional size for headerless tiles
+      if (ok && !(line >> terrain.heightMapWidth >> terrain.heightMapHeight))
+        terrain.heightMapWidth = terrain.heightMapHeight = 0;
+    } else if (block == Block::Terrain && key == "textures") {
+      ok = bool(line >> terrain.textureA >> terrain.textureB >> terrain.textureC);
+    } else if (block == Block::Terrain && key == "grid") {
+      ok = bool(line >> terrain.gridPoints) && terrain.gridPoints >= 2;
+    } else if (block == Block::Terrain && key == "scale") {
+      ok = bool(line >> terrain.scale);
+    } else if (block == Block::Terrain && key == "bands") {
+      ok = bool(line >> terrain.bandA >> terrain.bandB >> terrain.bandSizes);
+    } else if (block == Block::Terrain && key == "tess") {
+      ok = bool(line >> terrain.tessLevel);
+    } else if (block == Block::Mesh && key == "texture") {
+      ok = bool(line >> scene.meshes.back().texture);
+    } else if (block == Block::Mesh && key == "position") {
+      ok = readVec3(line, scene.meshes.back().position);
+    } else if (block == Block::Mesh && key == "rotation") {
+      ok = readVec3(line, scene.meshes.back().rotation);
+    } else if (block == Block::Mesh && key == "scale") {
+      ok = readVec3(line, scene.meshes.back().scale);
+    } else {
+      printf("%s:%d: unknown keyword %s\n", path, lineNumber, key.c_str());
+      continue;
+    }
+
+    if (!ok) {
+      printf("%s:%d: can't read %s\n", path, lineNumber, key.c_str());
+      return false;
+    }
+  }
+
+  printf("Scene has %s and %zu meshes\n",
+         scene.terrain ? "terrain" : "no terrain", scene.meshes.size());
+  return true;
+}
@@ -0,0 +1,65 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Everything that shapes the terrain. The defaults are the values the
+// renderer always used.
+struct TerrainParams {
+  std::string heightMapPath = "mountains_height.bmp";
+  // Size of headerless .r16/.r32 heightmaps, 0 is worked out from the file
+  int heightMapWidth = 0;
+  int heightMapHeight = 0;
+  std::string textureA = "grass";
+  std::string textureB = "rocks";
+  std::string textureC = "snow";
+  int gridPoints = 128;
+  float scale = 0.1f;
+  float bandA = 12;
+  float bandB = 25;
+  float bandSizes = 6;
+  float tessLevel = 16.0f;
+};
+
+struct SceneMesh {
+  std::string objPath;
+  // Texture name without extension, <name>.ktx or <name>.bmp
+  std::string texture;
+  glm::vec3 position = glm::vec3(0);
+  // Euler angles in degrees, applied X then Y then Z
+  glm::vec3 rotation = glm::vec3(0);
+  glm::vec3 scale = glm::vec3(1);
+};
+
+struct Scene {
+  bool terrain = true;
+  TerrainParams terrainParams;
+  std::vector<SceneMesh> meshes;
+};
+
+// Reads a scene file into scene, keeping whatever is already there for
+// anything the file doesn't mention. The format is line based like OBJ/MTL:
+// "terrain" and "mesh <file.obj>" open a block, the lines after it set
+// that block's properties.
+//
+//   terrain
+//   heightmap mountains_height.bmp
+//   textures grass rocks snow
+//   grid 128
+//   scale 0.1
+//   bands 12 25 6
+//   tess 16
+//
+//   mesh banana.obj
+//   texture banana
+//   position 0 2 0
+//   rotation 0 90 0
+//   scale 0.5
+//
+// "noterrain" leaves the terrain out altogether.
+bool loadSceneFile(const char *path, Scene &scene);
+
+#endif
@@ -0,0 +1,408 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BAKE_SSE2 1
+#endif
+
+#include "file_formats.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "texture_bake.hpp"
+
+// Colour channels of each level, kept in linear light between levels so
+// rounding errors don't pile up down the chain
+struct LinearImage {
+  int width = 0;
+  int height = 0;
+  std::vector<float> rgba;
+};
+
+struct GammaTables {
+  float toLinear[256];
+  uint8_t toSRGB[4096];
+
+  GammaTables() {
+    for (int i = 0; i < 256; i++) {
+      float c = i / 255.0f;
+      toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i < 4096; i++) {
+      float l = i / 4095.0f;
+      float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+      toSRGB[i] = uint8_t(std::min(255.0f, c * 255.0f + 0.5f));
+    }
+  }
+};
+
+static const GammaTables &gammaTables() {
+  static const GammaTables tables;
+  return tables;
+}
+
+bool readBMP(const char *path, Image &out) {
+  MappedFile file;
+  if (!file.open(path)) {
+    printf("%s could not be opened. Are you in the right directory ? !\n", path);
+    return false;
+  }
+
+  BMPLayout bmp;
+  if (!parseBMPHeader(file.data(), file.size(), bmp))
+    return false;
+  out.width = bmp.width;
+  out.height = bmp.height;
+  int pixelStride = bmp.pixelStride;
+
+  out.rgba.resize(size_t(out.width) * out.height * 4);
+  for (int y = 0; y < out.height; y++) {
+    // Keep GL's bottom-up row order whatever the file uses
+    int fileRow = bmp.bottomUp ? y : out.height - 1 - y;
+    const uint8_t *src = file.data() + bmp.offset + fileRow * bmp.rowStride;
+    uint8_t *dst = &out.rgba[size_t(y) * out.width * 4];
+    for (int x = 0; x < out.width; x++, src += pixelStride, dst += 4) {
+      dst[0] = src[2];
+      dst[1] = src[1];
+      dst[2] = src[0];
+      dst[3] = pixelStride == 4 ? src[3] : 255;
+    }
+  }
+  return true;
+}
+
+static LinearImage toLinear(const Image &image, bool srgb) {
+  const GammaTables &tables = gammaTables();
+  LinearImage out;
+  out.width = image.width;
+  out.height = image.height;
+  out.rgba.resize(image.rgba.size());
+  parallelFor(image.height, [&](int begin, int end) {
+    for (size_t i = size_t(begin) * image.width * 4; i < size_t(end) * image.width * 4; i++) {
+      bool colour = (i & 3) != 3;
+      out.rgba[i] = srgb && colour ? tables.toLinear[image.rgba[i]]
+                                   : image.rgba[i] / 255.0f;
+    }
+  });
+  return out;
+}
+
+static Image fromLinear(const LinearImage &image, bool srgb) {
+  const GammaTables &tables = gammaTables();
+  Image out;
+  out.width = image.width;
+  out.height = image.height;
+  out.rgba.resize(image.rgba.size());
+  parallelFor(image.height, [&](int begin, int end) {
+    for (size_t i = size_t(begin) * image.width; i < size_t(end) * image.width; i++) {
+      const float *src = &image.rgba[i * 4];
+      uint8_t *dst = &out.rgba[i * 4];
+      int index[4];
+#ifdef BAKE_SSE2
+      __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src), _mm_setzero_ps()),
+                            _mm_set1_ps(1.0f));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(index),
+                       _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(4095.0f))));
+#else
+      for (int c = 0; c < 4; c++)
+        index[c] = int(std::min(1.0f, std::max(0.0f, src[c])) * 4095.0f + 0.5f);
+#endif
+      for (int c = 0; c < 3; c++)
+        dst[c] = srgb ? tables.toSRGB[index[c]]
+                      : uint8_t((index[c] * 255 + 2047) / 4095);
+      dst[3] = uint8_t((index[3] * 255 + 2047) / 4095);
+    }
+  });
+  return out;
+}
+
+// 2x2 box filter, odd edges clamp onto the last row/column
+static LinearImage downsample(const LinearImage &src) {
+  LinearImage dst;
+  dst.width = std::max(1, src.width / 2);
+  dst.height = std::max(1, src.height / 2);
+  dst.rgba.resize(size_t(dst.width) * dst.height * 4);
+  parallelFor(dst.height, [&](int begin, int end) {
+    for (int y = begin; y < end; y++) {
+      const float *row0 = &src.rgba[size_t(std::min(2 * y, src.height - 1)) * src.width * 4];
+      const float *row1 = &src.rgba[size_t(std::min(2 * y + 1, src.height - 1)) * src.width * 4];
+      float *out = &dst.rgba[size_t(y) * dst.width * 4];
+      for (int x = 0; x < dst.width; x++, out += 4) {
+        int x0 = std::min(2 * x, src.width - 1) * 4;
+        int x1 = std::min(2 * x + 1, src.width - 1) * 4;
+#ifdef BAKE_SSE2
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+                                _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+        _mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+        for (int c = 0; c < 4; c++)
+          out[c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+#endif
+      }
+    }
+  });
+  return dst;
+}
+
+std::vector<Image> buildMipChain(const Image &base, bool srgb) {
+  std::vector<Image> levels;
+  levels.push_back(base);
+
+  LinearImage current = toLinear(base, srgb);
+  while (current.width > 1 || current.height > 1) {
+    current = downsample(current);
+    levels.push_back(fromLinear(current, srgb));
+  }
+  return levels;
+}
+
+static uint16_t to565(const float c[3]) {
+  auto q = [](float v, int bits) {
+    int max = (1 << bits) - 1;
+    return int(std::min(255.0f, std::max(0.0f, v)) * max / 255.0f + 0.5f);
+  };
+  return uint16_t(q(c[0], 5) << 11 | q(c[1], 6) << 5 | q(c[2], 5));
+}
+
+static void from565(uint16_t c, int out[3]) {
+  int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  out[0] = (r << 3) | (r >> 2);
+  out[1] = (g << 2) | (g >> 4);
+  out[2] = (b << 3) | (b >> 2);
+}
+
+static void writeU16(uint8_t *p, uint16_t v) {
+  p[0] = uint8_t(v);
+  p[1] = uint8_t(v >> 8);
+}
+
+// BC1 colour block: endpoints along the principal axis of the block's colours
+static void encodeColourBlock(const uint8_t texels[16][4], uint8_t out[8]) {
+  float mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < 3; c++)
+      mean[c] += texels[i][c] / 16.0f;
+
+  float cov[6] = {0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    float d[3] = {texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2]};
+    cov[0] += d[0] * d[0];
+    cov[1] += d[0] * d[1];
+    cov[2] += d[0] * d[2];
+    cov[3] += d[1] * d[1];
+    cov[4] += d[1] * d[2];
+    cov[5] += d[2] * d[2];
+  }
+
+  // A few rounds of power iteration are plenty for a 3x3 matrix
+  float axis[3] = {1, 1, 1};
+  for (int iter = 0; iter < 8; iter++) {
+    float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                     cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                     cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+    float len = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+    if (len < 1e-6f)
+      break;
+    for (int c = 0; c < 3; c++)
+      axis[c] = next[c] / len;
+  }
+
+  float tMin = 0, tMax = 0;
+  for (int i = 0; i < 16; i++) {
+    float t = 0;
+    for (int c = 0; c < 3; c++)
+      t += (texels[i][c] - mean[c]) * axis[c];
+    tMin = std::min(tMin, t);
+    tMax = std::max(tMax, t);
+  }
+  // Inset the endpoints a little, the extremes are rarely worth hitting exactly
+  float inset = (tMax - tMin) / 16.0f;
+  tMin += inset;
+  tMax -= inset;
+
+  float e0[3], e1[3];
+  for (int c = 0; c < 3; c++) {
+    e0[c] = mean[c] + axis[c] * tMax;
+    e1[c] = mean[c] + axis[c] * tMin;
+  }
+  uint16_t c0 = to565(e0), c1 = to565(e1);
+  // Four colour mode needs c0 > c1
+  if (c0 < c1)
+    std::swap(c0, c1);
+  writeU16(out, c0);
+  writeU16(out + 2, c1);
+
+  uint32_t indices = 0;
+  if (c0 != c1) {
+    int palette[4][3];
+    from565(c0, palette[0]);
+    from565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    for (int i = 0; i < 16; i++) {
+      int best = 0, bestError = 1 << 30;
+      for (int p = 0; p < 4; p++) {
+        int error = 0;
+        for (int c = 0; c < 3; c++) {
+          int d = texels[i][c] - palette[p][c];
+          error += d * d;
+        }
+        if (error < bestError) {
+          bestError = error;
+          best = p;
+        }
+      }
+      indices |= uint32_t(best) << (2 * i);
+    }
+  }
+  for (int b = 0; b < 4; b++)
+    out[4 + b] = uint8_t(indices >> (8 * b));
+}
+
+// BC4 single channel block, as used for BC3 alpha and both halves of BC5
+static void encodeChannelBlock(const uint8_t texels[16][4], int channel,
+                               uint8_t out[8]) {
+  int hi = 0, lo = 255;
+  for (int i = 0; i < 16; i++) {
+    hi = std::max(hi, int(texels[i][channel]));
+    lo = std::min(lo, int(texels[i][channel]));
+  }
+  out[0] = uint8_t(hi);
+  out[1] = uint8_t(lo);
+
+  uint64_t indices = 0;
+  if (hi != lo) {
+    // Eight value mode (hi > lo): hi, lo, then six steps in between
+    int palette[8] = {hi, lo};
+    for (int p = 2; p < 8; p++)
+      palette[p] = ((8 - p) * hi + (p - 1) * lo) / 7;
+    for (int i = 0; i < 16; i++) {
+      int best = 0, bestError = 1 << 30;
+      for (int p = 0; p < 8; p++) {
+        int error = std::abs(texels[i][channel] - palette[p]);
+        if (error < bestError) {
+          bestError = error;
+          best = p;
+        }
+      }
+      indices |= uint64_t(best) << (3 * i);
+    }
+  }
+  for (int b = 0; b < 6; b++)
+    out[2 + b] = uint8_t(indices >> (8 * b));
+}
+
+static int blockBytes(BlockFormat format) { return format == BlockFormat::BC1 ? 8 : 16; }
+
+std::vector<uint8_t> compressImage(const Image &image, BlockFormat format) {
+  int blocksX = (image.width + 3) / 4;
+  int blocksY = (image.height + 3) / 4;
+  int bytes = blockBytes(format);
+  std::vector<uint8_t> out(size_t(blocksX) * blocksY * bytes);
+
+  parallelFor(blocksY, [&](int begin, int end) {
+    uint8_t texels[16][4];
+    for (int by = begin; by < end; by++) {
+      for (int bx = 0; bx < blocksX; bx++) {
+        // Blocks hanging over the edge repeat the last row/column
+        for (int i = 0; i < 16; i++) {
+          int x = std::min(bx * 4 + (i & 3), image.width - 1);
+          int y = std::min(by * 4 + (i >> 2), image.height - 1);
+          memcpy(texels[i], &image.rgba[(size_t(y) * image.width + x) * 4], 4);
+        }
+
+        uint8_t *block = &out[(size_t(by) * blocksX + bx) * bytes];
+        switch (format) {
+        case BlockFormat::BC1:
+          encodeColourBlock(texels, block);
+          break;
+        case BlockFormat::BC3:
+          encodeChannelBlock(texels, 3, block);
+          encodeColourBlock(texels, block + 8);
+          break;
+        case BlockFormat::BC5:
+          encodeChannelBlock(texels, 0, block);
+          encodeChannelBlock(texels, 1, block + 8);
+          break;
+        }
+      }
+    }
+  });
+  return out;
+}
+
+uint32_t glInternalFormat(BlockFormat format) {
+  switch (format) {
+  case BlockFormat::BC1:
+    return ktx_compressed_rgb_s3tc_dxt1;
+  case BlockFormat::BC3:
+    return ktx_compressed_rgba_s3tc_dxt5;
+  case BlockFormat::BC5:
+    return ktx_compressed_rg_rgtc2;
+  }
+  return 0;
+}
+
+uint32_t glBaseInternalFormat(BlockFormat format) {
+  switch (format) {
+  case BlockFormat::BC1:
+    return 0x1907; // GL_RGB
+  case BlockFormat::BC3:
+    return 0x1908; // GL_RGBA
+  case BlockFormat::BC5:
+    return 0x8227; // GL_RG
+  }
+  return 0;
+}
+
+bool writeKTX(const char *path, BlockFormat format, int width, int height,
+              const std::vector<std::vector<uint8_t>> &levels) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    printf("%s could not be written\n", path);
+    return false;
+  }
+
+  // Rows are stored bottom-up, the way glCompressedTexImage2D reads them
+  static const char orientation[] = "KTXorientation\0S=r,T=u";
+  uint32_t orientationBytes = sizeof(orientation);
+  uint32_t keyValueBytes = 4 + ((orientationBytes + 3) & ~3u);
+
+  uint32_t header[13] = {
+      0x04030201,                     // endianness
+      0,                              // glType, 0 for compressed
+      1,                              // glTypeSize
+      0,                              // glFormat, 0 for compressed
+      glInternalFormat(format),       // glInternalFormat
+      glBaseInternalFormat(format),   // glBaseInternalFormat
+      uint32_t(width),                // pixelWidth
+      uint32_t(height),               // pixelHeight
+      0,                              // pixelDepth
+      0,                              // numberOfArrayElements
+      1,                              // numberOfFaces
+      uint32_t(levels.size()),        // numberOfMipmapLevels
+      keyValueBytes                   // bytesOfKeyValueData
+  };
+  fwrite(ktx_identifier, 1, sizeof(ktx_identifier), file);
+  fwrite(header, 4, 13, file);
+
+  static const uint8_t padding[4] = {0, 0, 0, 0};
+  fwrite(&orientationBytes, 4, 1, file);
+  fwrite(orientation, 1, orientationBytes, file);
+  fwrite(padding, 1, keyValueBytes - 4 - orientationBytes, file);
+
+  for (const std::vector<uint8_t> &level : levels) {
+    uint32_t imageSize = uint32_t(level.size());
+    fwrite(&imageSize, 4, 1, file);
+    fwrite(level.data(), 1, level.size(), file);
+    // Blocks are 8 or 16 bytes so levels are always 4 byte aligned
+  }
+
+  bool ok = ferror(file) == 0;
+  fclose(file);
+  return ok;
+}
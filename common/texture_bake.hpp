@@ -0,0 +1,46 @@
+#ifndef TEXTURE_BAKE_HPP
+#define TEXTURE_BAKE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// CPU side of the texture baker: mip generation, block compression and the
+// KTX container. Nothing in here touches OpenGL, the enums below are the GL
+// values written into the KTX header.
+
+enum class BlockFormat {
+  BC1, // RGB, 4bpp
+  BC3, // RGBA, 8bpp
+  BC5  // Two independent channels (normals, height derivatives), 8bpp
+};
+
+static const uint32_t ktx_compressed_rgb_s3tc_dxt1 = 0x83F0;
+static const uint32_t ktx_compressed_rgba_s3tc_dxt5 = 0x83F3;
+static const uint32_t ktx_compressed_rg_rgtc2 = 0x8DBD;
+
+// 8-bit RGBA, rows bottom to top like glTexImage2D expects
+struct Image {
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> rgba;
+};
+
+// 24/32bpp uncompressed BMP
+bool readBMP(const char *path, Image &out);
+
+// Builds the full mip chain down to 1x1. When srgb is set colour channels are
+// filtered in linear light and re-encoded, alpha is always filtered linearly.
+std::vector<Image> buildMipChain(const Image &base, bool srgb);
+
+// Compresses one level, returns the blocks in the layout GL expects
+std::vector<uint8_t> compressImage(const Image &image, BlockFormat format);
+
+uint32_t glInternalFormat(BlockFormat format);
+uint32_t glBaseInternalFormat(BlockFormat format);
+
+// Writes a KTX 1.1 file with one compressed payload per mip level
+bool writeKTX(const char *path, BlockFormat format, int width, int height,
+              const std::vector<std::vector<uint8_t>> &levels);
+
+#endif
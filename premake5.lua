@@ -83,6 +83,31 @@ project "main"
 
 	dependson "x-glm" 
 
+-- The same renderer, built to run the -regress harness on regress/ when
+-- started without arguments. Exits non-zero on a regression, so CI can
+-- build and run it. Seed regress/ on the reference machine with
+-- "regress -regress-update regress".
+project "regress"
+	local sources = { 
+		"src/**.cpp",
+		"src/**.hpp",
+	}
+
+	kind "ConsoleApp"
+	location "src"
+
+	files( sources )
+
+	defines { "REGRESS_TARGET=1" }
+
+	links "common"
+	links "x-glfw"
+	links "x-glew"
+
+	includedirs( "." );
+
+	dependson "x-glm" 
+
 project "common"
 	local sources = { 
 		"common/**.cpp",
@@ -94,4 +119,36 @@ project "common"
 
 	files( sources )
 
+project "bake"
+	local sources = { 
+		"tools/bake/**.cpp",
+		"tools/bake/**.hpp",
+	}
+
+	kind "ConsoleApp"
+	location "tools/bake"
+
+	files( sources )
+
+	links "common"
+
+	includedirs( "." );
+
+	dependson "x-glm" 
+
+project "jobbench"
+	local sources = { 
+		"tools/jobbench/**.cpp",
+		"tools/jobbench/**.hpp",
+	}
+
+	kind "ConsoleApp"
+	location "tools/jobbench"
+
+	files( sources )
+
+	links "common"
+
+	includedirs( "." );
+
 --EOF
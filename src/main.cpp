@@ -1,6 +1,11 @@
 // Include standard headers
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,16 +26,27 @@ using namespace std;
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
+#include <common/clusters.hpp>
 #include <common/controls.hpp>
+#include <common/heightmap.hpp>
+#include <common/jobs.hpp>
+#include <common/ktx.hpp>
+#include <common/pacing.hpp>
+#include <common/process_stats.hpp>
+#include <common/regress.hpp>
+#include <common/resolution.hpp>
+#include <common/resource_cache.hpp>
+#include <common/resources.hpp>
+#include <common/scene.hpp>
 
 static const int window_width = 1920;
 static const int window_height = 1080;
 
-static const int n_points = 128;
-static const float m_scale = 0.1f;
-static const float m_band_a = 12;
-static const float m_band_b = 25;
-static const float m_band_sizes = 6;
+// Terrain grid resolution, set from the command line or scene file
+static int n_points = 128;
+// Height scale and texture bands of the terrain
+TerrainParams terrainParams;
+bool terrainEnabled = true;
 
 // Variables
 GLFWwindow *window;
@@ -47,6 +63,44 @@ GLuint TextureC;
 GLuint TextureCSpecularMap;
 GLuint HeightMapTexture;
 
+// Textures shared between the terrain and scene meshes, keyed by name
+ResourceCache<GLuint> textureCache;
+
+// A loaded OBJ, shared by every mesh instance that uses the file
+struct MeshResource {
+  std::vector<unsigned int> indices;
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec2> uvs;
+  std::vector<glm::vec3> normals;
+  GLuint vertexArrayID = 0;
+  GLuint vertexbuffer = 0;
+  GLuint uvbuffer = 0;
+  GLuint normalbuffer = 0;
+  GLuint elementbuffer = 0;
+  GLsizei indexCount = 0;
+};
+ResourceCache<MeshResource> meshCache;
+
+struct MeshInstance {
+  std::string objPath;
+  std::string textureName;
+  MeshResource *mesh;
+  // Null for meshes without a texture
+  GLuint *texture;
+  glm::mat4 ModelMatrix;
+};
+std::vector<MeshInstance> meshInstances;
+GLuint meshProgramID;
+
+// Load time of every asset, from the start of its decode to the end of its
+// upload, and of the whole scene
+std::mutex assetLoadMutex;
+std::vector<std::pair<std::string, double>> assetLoadMs;
+double sceneLoadMs = 0.0;
+
+// GPU memory limit from -budget, 0 means none
+size_t gpuBudget = 0;
+
 // Model
 std::vector<unsigned int> indices;
 std::vector<glm::vec3> vertices;
@@ -56,6 +110,9 @@ std::vector<glm::vec3> normals;
 // VAO
 GLuint VertexArrayID;
 
+// Terrain grid is generated in the vertex shader, no buffers at all
+bool proceduralTerrain = false;
+
 // Buffers for VAO
 GLuint vertexbuffer;
 GLuint uvbuffer;
@@ -64,15 +121,95 @@ GLuint elementbuffer;
 
 glm::ivec2 heightMapSize;
 glm::vec2 heightMapUVStepSize;
+float heightMapRange;
+
+// Tessellation level of the terrain patches
+float tessLevel = 16.0f;
+// Bumped whenever what the tessellation stages produce could change
+int heightMapVersion = 0;
+int terrainShaderVersion = 0;
+
+// Transform feedback cache of the tessellated terrain. The output of
+// Simple.tese is captured once and redrawn with Cached.vert until the
+// tessellation level, heightmap or shaders change.
+struct TessellationCache {
+  size_t budget = 0; // bytes, 0 disables the cache
+  GLuint programID = 0;
+  GLuint feedback = 0;
+  GLuint buffer = 0;
+  GLuint vertexArrayID = 0;
+  GLuint primitivesQuery = 0;
+  size_t capacity = 0;
+  size_t primitives = 0;
+  // What the captured geometry was built from
+  bool valid = false;
+  float tessLevel = 0;
+  int heightMapVersion = -1;
+  int shaderVersion = -1;
+  // Set when the capture doesn't fit the budget, cleared when the key changes
+  bool overBudget = false;
+  long hits = 0;
+  long misses = 0;
+};
+TessellationCache tessCache;
+
+// Offscreen render target, sized for the maximum resolution scale
+GLuint sceneFramebuffer;
+GLuint sceneColorTexture;
+GLuint sceneDepthRenderbuffer;
+glm::ivec2 sceneTargetSize;
+glm::ivec2 sceneRenderSize;
+
+// Upscale pass
+GLuint upscaleProgramID;
+GLuint upscaleVertexArrayID;
+
+// Lighting: the fixed light, plus any number of point lights binned into
+// clusters every frame
+glm::vec3 lightColor = glm::vec3(1, 1, 1);
+static const float terrainLightPower = 1.0f;
+static const float meshLightPower = 40.0f;
+std::vector<PointLight> pointLights;
+// Where each point light drifts around, w is its phase
+std::vector<glm::vec4> pointLightHomes;
+LightClusters lightClusters;
+// Units 0-6 are the terrain textures
+static const int clusterTextureUnit = 7;
+
+// Light count sweep, see lightSweepFrame
+static const int lightSweepCounts[] = {0, 256, 1024, 4096, 16384};
+static const int lightSweepWarmup = 30;
+static const int lightSweepFrames = 240;
+
+// GPU timer queries, read back a few frames late so we never stall
+static const int n_timer_queries = 3;
+GLuint sceneTimerQueries[n_timer_queries];
+int sceneTimerFrame = 0;
 
 // Processing command line arguments
 
 struct CLIArgs {
   std::string modelPath = "";
-  std::string textureA = "grass";
-  std::string textureB = "rocks";
-  std::string textureC = "snow";
-  std::string heightMapPath = "mountains_height.bmp";
+  std::string scenePath = "";
+  // Defaults for the terrain, a scene file can override them
+  TerrainParams terrain;
+  bool proceduralTerrain = false;
+  // -tfcache, the captured terrain takes 96 bytes per triangle, which at the
+  // default grid and tessellation level is about 790 MB
+  int tessCacheMB = 0;
+  int budgetMB = 0;
+  int pointLights = 0;
+  bool lightSweep = false;
+  // Golden images and baseline for -regress, rewritten by -regress-update
+  std::string regressDir = "";
+  bool regressUpdate = false;
+  float minResolutionScale = 0.5f;
+  float maxResolutionScale = 1.0f;
+  float targetFrameMs = 16.6f;
+  // Frame pacing, the defaults leave both to the driver
+  int swapInterval = -1;
+  int framesInFlight = 0;
+  bool lateInput = false;
 };
 CLIArgs processCLIArgs(int argc, char *argv[]) {
   CLIArgs args;
@@ -84,8 +221,104 @@ CLIArgs processCLIArgs(int argc, char *argv[]) {
       continue;
     }
 
+    if (argv[i] == std::string("-scene")) {
+      args.scenePath = argv[i + 1];
+      i++;
+      continue;
+    }
+
     if (argv[i] == std::string("-h")) {
-      args.heightMapPath = argv[i + 1];
+      args.terrain.heightMapPath = argv[i + 1];
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-hsize")) {
+      args.terrain.heightMapWidth = std::stoi(argv[i + 1]);
+      args.terrain.heightMapHeight = std::stoi(argv[i + 2]);
+      i += 2;
+      continue;
+    }
+
+    if (argv[i] == std::string("-n")) {
+      args.terrain.gridPoints = std::max(2, std::stoi(argv[i + 1]));
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-p")) {
+      args.proceduralTerrain = true;
+      continue;
+    }
+
+    if (argv[i] == std::string("-tess")) {
+      args.terrain.tessLevel = std::stof(argv[i + 1]);
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-tfcache")) {
+      args.tessCacheMB = std::stoi(argv[i + 1]);
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-budget")) {
+      args.budgetMB = std::stoi(argv[i + 1]);
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-lights")) {
+      args.pointLights = std::max(0, std::stoi(argv[i + 1]));
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-lightsweep")) {
+      args.lightSweep = true;
+      continue;
+    }
+
+    if (argv[i] == std::string("-regress") ||
+        argv[i] == std::string("-regress-update")) {
+      args.regressUpdate = argv[i] == std::string("-regress-update");
+      args.regressDir = argv[i + 1];
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-swap")) {
+      args.swapInterval = std::stoi(argv[i + 1]);
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-fif")) {
+      args.framesInFlight = std::max(0, std::stoi(argv[i + 1]));
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-lateinput")) {
+      args.lateInput = true;
+      continue;
+    }
+
+    if (argv[i] == std::string("-rmin")) {
+      args.minResolutionScale = std::stof(argv[i + 1]);
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-rmax")) {
+      args.maxResolutionScale = std::stof(argv[i + 1]);
+      i++;
+      continue;
+    }
+
+    if (argv[i] == std::string("-rtarget")) {
+      args.targetFrameMs = std::stof(argv[i + 1]);
       i++;
       continue;
     }
@@ -94,6 +327,11 @@ CLIArgs processCLIArgs(int argc, char *argv[]) {
   return args;
 }
 
+void recordLoadTime(const std::string &name, double startTime) {
+  std::lock_guard<std::mutex> lock(assetLoadMutex);
+  assetLoadMs.emplace_back(name, (glfwGetTime() - startTime) * 1000.0);
+}
+
 void getErrors() {
   GLenum err;
   while ((err = glGetError()) != GL_NO_ERROR) {
@@ -101,8 +339,14 @@ void getErrors() {
   }
 }
 
-GLuint loadBMP_custom(const char *imagepath, GLenum filter_mode,
-                      GLenum what_happens_at_edge, int &width, int &height) {
+// Pixels of a 24bpp BMP, read on a worker and uploaded on the main thread
+struct BMPImage {
+  int width = 0;
+  int height = 0;
+  std::vector<unsigned char> data;
+};
+
+bool readBMP_custom(const char *imagepath, BMPImage &image) {
 
   printf("Reading image %s\n", imagepath);
 
@@ -110,15 +354,14 @@ GLuint loadBMP_custom(const char *imagepath, GLenum filter_mode,
   unsigned char header[54];
   unsigned int dataPos;
   unsigned int imageSize;
-  // Actual RGB data
-  unsigned char *data;
+  int width, height;
 
   // Open the file
   FILE *file = fopen(imagepath, "rb");
   if (!file) {
     printf("%s could not be opened. Are you in the right directory ? !\n",
            imagepath);
-    return 0;
+    return false;
   }
 
   // Read the header, i.e. the 54 first bytes
@@ -127,24 +370,24 @@ GLuint loadBMP_custom(const char *imagepath, GLenum filter_mode,
   if (fread(header, 1, 54, file) != 54) {
     printf("Not a correct BMP file\n");
     fclose(file);
-    return 0;
+    return false;
   }
   // A BMP files always begins with "BM"
   if (header[0] != 'B' || header[1] != 'M') {
     printf("Not a correct BMP file\n");
     fclose(file);
-    return 0;
+    return false;
   }
   // Make sure this is a 24bpp file
   if (*(int *)&(header[0x1E]) != 0) {
     printf("Not a correct BMP file\n");
     fclose(file);
-    return 0;
+    return false;
   }
   if (*(int *)&(header[0x1C]) != 24) {
     printf("Not a correct BMP file\n");
     fclose(file);
-    return 0;
+    return false;
   }
 
   // Read the information about the image
@@ -161,15 +404,21 @@ GLuint loadBMP_custom(const char *imagepath, GLenum filter_mode,
     dataPos = 54; // The BMP header is done that way
 
   // Create a buffer
-  data = new unsigned char[imageSize];
+  image.width = width;
+  image.height = height;
+  image.data.resize(imageSize);
 
   // Read the actual data from the file into the buffer
   fseek(file, dataPos, SEEK_SET);
-  fread(data, 1, imageSize, file);
+  fread(image.data.data(), 1, imageSize, file);
 
   // Everything is in memory now, the file can be closed.
   fclose(file);
+  return true;
+}
 
+GLuint uploadBMP(const BMPImage &image, GLenum filter_mode,
+                 GLenum what_happens_at_edge) {
   // Create one OpenGL texture
   GLuint textureID;
   glGenTextures(1, &textureID);
@@ -181,11 +430,8 @@ GLuint loadBMP_custom(const char *imagepath, GLenum filter_mode,
   // Give the image to OpenGL
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR,
-               GL_UNSIGNED_BYTE, data);
-
-  // OpenGL has now copied the data. Free our own version
-  delete[] data;
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, image.width, image.height, 0, GL_BGR,
+               GL_UNSIGNED_BYTE, image.data.data());
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, what_happens_at_edge);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, what_happens_at_edge);
@@ -202,6 +448,38 @@ GLuint loadBMP_custom(const char *imagepath, GLenum filter_mode,
   return textureID;
 }
 
+// Prefers a baked <name>.ktx (see tools/bake) and falls back to <name>.bmp.
+// A BMP is decoded on a worker and only the upload comes back to the main
+// thread. Done when counter reaches zero.
+void loadTextureAsync(const std::string &name, GLenum filter_mode,
+                      GLenum what_happens_at_edge, GLuint &textureID,
+                      JobCounter &counter) {
+  int width, height;
+  double startTime = glfwGetTime();
+  textureID = loadKTX((name + ".ktx").c_str(), filter_mode,
+                      what_happens_at_edge, width, height);
+  if (textureID != 0) {
+    resources().trackTexture(textureID, "materials", name);
+    recordLoadTime(name, startTime);
+    return;
+  }
+
+  JobSystem &jobs = jobSystem();
+  jobs.run([=, &jobs, &textureID, &counter] {
+    double startTime = glfwGetTime();
+    auto image = std::make_shared<BMPImage>();
+    if (!readBMP_custom((name + ".bmp").c_str(), *image))
+      return;
+    resources().addStaging("materials", image->data.size());
+    jobs.runOnMainThread([=, &textureID] {
+      textureID = uploadBMP(*image, filter_mode, what_happens_at_edge);
+      resources().removeStaging("materials", image->data.size());
+      resources().trackTexture(textureID, "materials", name);
+      recordLoadTime(name, startTime);
+    }, &counter);
+  }, &counter);
+}
+
 bool loadOBJ(const char *path, std::vector<glm::vec3> &out_vertices,
              std::vector<glm::vec2> &out_uvs,
              std::vector<glm::vec3> &out_normals,
@@ -294,7 +572,7 @@ bool loadOBJ(const char *path, std::vector<glm::vec3> &out_vertices,
   return true;
 }
 
-int initializeGLFW() {
+int initializeGLFW(bool visible) {
   // Initialise GLFW
   if (!glfwInit()) {
     fprintf(stderr, "Failed to initialize GLFW\n");
@@ -308,6 +586,7 @@ int initializeGLFW() {
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT,
                  GL_TRUE); // To make MacOS happy; should not be needed
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
   // Open a window and create its OpenGL context
   window = glfwCreateWindow(window_width, window_height, "OpenGLRenderer", NULL,
@@ -384,7 +663,8 @@ bool LoadShaders(GLuint &program, const char *vertex_file_path,
                  const char *fragment_file_path,
                  const char *tess_control_path = nullptr,
                  const char *tess_eval_file_path = nullptr,
-                 const char *geometry_file_path = nullptr) {
+                 const char *geometry_file_path = nullptr,
+                 const std::vector<const char *> &feedback_varyings = {}) {
   // Create the shaders - tasks 1 and 2
   GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
   GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
@@ -428,6 +708,12 @@ bool LoadShaders(GLuint &program, const char *vertex_file_path,
   if (geometry_file_path)
     glAttachShader(program, GeometryShaderID);
 
+  // Outputs to capture with transform feedback, must be set before linking
+  if (!feedback_varyings.empty())
+    glTransformFeedbackVaryings(program, GLsizei(feedback_varyings.size()),
+                                feedback_varyings.data(),
+                                GL_INTERLEAVED_ATTRIBS);
+
   glLinkProgram(program);
 
   // Check the program
@@ -456,10 +742,14 @@ bool LoadShaders(GLuint &program, const char *vertex_file_path,
 
 void UnloadShaders() { glDeleteProgram(terrainProgramID); }
 
-void LoadModel(string path, GLint mode) {
-
-  glGenVertexArrays(1, &VertexArrayID);
-  glBindVertexArray(VertexArrayID);
+// CPU side of loading the model, safe to run on a worker
+void BuildModel(string path, GLint mode) {
+  if (path == "" && proceduralTerrain) {
+    // Patch corners come from gl_VertexID/gl_InstanceID, nothing to upload
+    if (mode != GL_PATCHES)
+      std::cout << "Procedural terrain needs patches, can't process that mode..." << endl;
+    return;
+  }
 
   if (path == "") {
     // Create mesh of n_points x n_points with normals up, and obvious uv
@@ -467,8 +757,8 @@ void LoadModel(string path, GLint mode) {
     for (int i = 0; i < n_points; i++) {
       for (int j = 0; j < n_points; j++) {
         // Lets center the plane around the zero
-        float x = (m_scale * i) - (m_scale * n_points) / 2.0f;
-        float z = (m_scale * j) - (m_scale * n_points) / 2.0f;
+        float x = (terrainParams.scale * i) - (terrainParams.scale * n_points) / 2.0f;
+        float z = (terrainParams.scale * j) - (terrainParams.scale * n_points) / 2.0f;
         vertices.push_back(glm::vec3(x, 0, z));
         uvs.push_back(glm::vec2(float(i + 0.5f) / float(n_points - 1),
                                 float(j + 0.5f) / float(n_points - 1)));
@@ -521,6 +811,16 @@ void LoadModel(string path, GLint mode) {
   } else {
     loadOBJ(path.c_str(), vertices, uvs, normals, indices);
   }
+}
+
+// GL side of loading the model, main thread only
+void UploadModel() {
+  glGenVertexArrays(1, &VertexArrayID);
+  glBindVertexArray(VertexArrayID);
+
+  // Nothing to upload for the procedural grid
+  if (vertices.empty())
+    return;
 
   // Load it into a VBO
 
@@ -568,10 +868,28 @@ void LoadModel(string path, GLint mode) {
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
                &indices[0], GL_STATIC_DRAW);
+
+  ResourceRegistry &registry = resources();
+  size_t positionBytes = vertices.size() * sizeof(glm::vec3);
+  size_t uvBytes = uvs.size() * sizeof(glm::vec2);
+  size_t normalBytes = normals.size() * sizeof(glm::vec3);
+  size_t indexBytes = indices.size() * sizeof(unsigned int);
+  registry.trackBuffer(vertexbuffer, "terrain", "grid positions", positionBytes);
+  registry.trackBuffer(uvbuffer, "terrain", "grid uvs", uvBytes);
+  registry.trackBuffer(normalbuffer, "terrain", "grid normals", normalBytes);
+  registry.trackBuffer(elementbuffer, "terrain", "grid indices", indexBytes);
+  // The CPU copy stays around
+  registry.trackHost("terrain", "grid", positionBytes + uvBytes + normalBytes + indexBytes);
 }
 
 void UnloadModel() {
   // Cleanup VBO and shader
+  ResourceRegistry &registry = resources();
+  registry.untrackBuffer(vertexbuffer);
+  registry.untrackBuffer(uvbuffer);
+  registry.untrackBuffer(normalbuffer);
+  registry.untrackBuffer(elementbuffer);
+  registry.trackHost("terrain", "grid", 0);
   glDeleteBuffers(1, &vertexbuffer);
   glDeleteBuffers(1, &uvbuffer);
   glDeleteBuffers(1, &normalbuffer);
@@ -579,77 +897,407 @@ void UnloadModel() {
   glDeleteVertexArrays(1, &VertexArrayID);
 }
 
+// Shared material texture, loaded the first time anything asks for it
+GLuint &acquireTexture(const std::string &name, JobCounter &loaded) {
+  bool created;
+  GLuint &textureID = textureCache.acquire(name, created);
+  if (created)
+    loadTextureAsync(name, GL_LINEAR_MIPMAP_LINEAR, GL_MIRRORED_REPEAT,
+                     textureID, loaded);
+  return textureID;
+}
+
+void releaseTexture(const std::string &name) {
+  textureCache.release(name, [](GLuint &textureID) {
+    resources().untrackTexture(textureID);
+    glDeleteTextures(1, &textureID);
+  });
+}
+
 void LoadTextures(const std::string &texAName,
                   const std::string &texBName,
                   const std::string &texCName,
-                  const std::string &heightMapPath) {
-  // Load the texture
-  int w, h;
-  TextureA = loadBMP_custom((texAName + ".bmp").c_str(),
-                            GL_LINEAR_MIPMAP_LINEAR,
-                            GL_MIRRORED_REPEAT, w, h);
-  TextureASpecularMap = loadBMP_custom((texAName + "-s.bmp").c_str(),
-                                       GL_LINEAR_MIPMAP_LINEAR,
-                                       GL_MIRRORED_REPEAT, w, h);
-  TextureB = loadBMP_custom((texBName + ".bmp").c_str(),
-                            GL_LINEAR_MIPMAP_LINEAR,
-                            GL_MIRRORED_REPEAT, w, h);
-  TextureBSpecularMap = loadBMP_custom((texBName + "-s.bmp").c_str(),
-                                       GL_LINEAR_MIPMAP_LINEAR,
-                                       GL_MIRRORED_REPEAT, w, h);
-  TextureC = loadBMP_custom((texCName + ".bmp").c_str(),
-                            GL_LINEAR_MIPMAP_LINEAR,
-                            GL_MIRRORED_REPEAT, w, h);
-  TextureCSpecularMap = loadBMP_custom((texCName + "-s.bmp").c_str(),
-                                       GL_LINEAR_MIPMAP_LINEAR,
-                                       GL_MIRRORED_REPEAT, w, h);
-
-  HeightMapTexture = loadBMP_custom(heightMapPath.c_str(),
-                                    GL_NEAREST, // Nearest neighbour so we don't get muddy pixels
-                                    GL_MIRRORED_REPEAT, w, h);
-  heightMapSize = glm::ivec2(w, h);
-  heightMapUVStepSize = glm::vec2(1.0f / float(w), 1.0f / float(h));
+                  const std::string &heightMapPath,
+                  int heightMapWidth, int heightMapHeight,
+                  JobCounter &loaded) {
+  // Load the textures, the BMPs decode on the workers
+  acquireTexture(texAName, loaded);
+  acquireTexture(texAName + "-s", loaded);
+  acquireTexture(texBName, loaded);
+  acquireTexture(texBName + "-s", loaded);
+  acquireTexture(texCName, loaded);
+  acquireTexture(texCName + "-s", loaded);
+
+  // The heightmap streams in on this thread, converting on all of them
+
+  HeightMap heightMap;
+  double startTime = glfwGetTime();
+  if (loadHeightMap(heightMapPath.c_str(), heightMapWidth, heightMapHeight,
+                    heightMap)) {
+    recordLoadTime(heightMapPath, startTime);
+  } else {
+    // Carry on with flat ground rather than sampling texture 0 with an
+    // infinite UV step
+    printf("Could not load heightmap %s, using flat terrain\n",
+           heightMapPath.c_str());
+    const float flat = 0.0f;
+    glGenTextures(1, &heightMap.texture);
+    glBindTexture(GL_TEXTURE_2D, heightMap.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, 1, 1, 0, GL_RED, GL_FLOAT, &flat);
+    heightMap.width = 1;
+    heightMap.height = 1;
+  }
+  resources().trackTexture(heightMap.texture, "terrain", heightMapPath);
+  HeightMapTexture = heightMap.texture;
+  glBindTexture(GL_TEXTURE_2D, HeightMapTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+  // Nearest neighbour so we don't get muddy pixels
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  heightMapSize = glm::ivec2(heightMap.width, heightMap.height);
+  heightMapUVStepSize = glm::vec2(1.0f / float(heightMap.width),
+                                  1.0f / float(heightMap.height));
+  heightMapRange = heightMap.valueRange;
+  heightMapVersion++;
+}
+
+// The cache entries are only filled in once their upload ran
+void resolveTerrainTextures() {
+  TextureA = *textureCache.find(terrainParams.textureA);
+  TextureASpecularMap = *textureCache.find(terrainParams.textureA + "-s");
+  TextureB = *textureCache.find(terrainParams.textureB);
+  TextureBSpecularMap = *textureCache.find(terrainParams.textureB + "-s");
+  TextureC = *textureCache.find(terrainParams.textureC);
+  TextureCSpecularMap = *textureCache.find(terrainParams.textureC + "-s");
 }
 
 void UnloadTextures() {
-  glDeleteTextures(1, &TextureA);
-  glDeleteTextures(1, &TextureB);
-  glDeleteTextures(1, &TextureC);
+  releaseTexture(terrainParams.textureA);
+  releaseTexture(terrainParams.textureA + "-s");
+  releaseTexture(terrainParams.textureB);
+  releaseTexture(terrainParams.textureB + "-s");
+  releaseTexture(terrainParams.textureC);
+  releaseTexture(terrainParams.textureC + "-s");
+  resources().untrackTexture(HeightMapTexture);
   glDeleteTextures(1, &HeightMapTexture);
 }
 
-void terrainSetup(const CLIArgs &args, GLenum mode) {
+void LoadTerrainShaders() {
+  // Captured by the tessellation cache, in the layout Cached.vert reads
   LoadShaders(terrainProgramID,
-              "src/shaders/Simple.vert",
+              proceduralTerrain ? "src/shaders/Procedural.vert"
+                                : "src/shaders/Simple.vert",
               "src/shaders/Simple.frag",
               "src/shaders/Simple.tesc",
-              "src/shaders/Simple.tese");
+              "src/shaders/Simple.tese",
+              nullptr,
+              {"Position_worldspace", "UV", "Normal_modelspace"});
+  if (tessCache.budget > 0) {
+    glDeleteProgram(tessCache.programID);
+    LoadShaders(tessCache.programID, "src/shaders/Cached.vert",
+                "src/shaders/Simple.frag");
+  }
+  terrainShaderVersion++;
+}
+
+// Starts loading the terrain, done once loaded reaches zero
+void terrainSetup(const TerrainParams &params, const CLIArgs &args,
+                  GLenum mode, JobCounter &loaded) {
+  terrainParams = params;
+  n_points = params.gridPoints;
+  proceduralTerrain = args.proceduralTerrain && args.modelPath == "";
+  tessLevel = params.tessLevel;
+  tessCache.budget = size_t(std::max(0, args.tessCacheMB)) << 20;
+  JobSystem &jobs = jobSystem();
+
+  // Geometry is built on a worker, then uploaded back on this thread
+  auto built = std::make_shared<JobCounter>();
+  std::string modelPath = args.modelPath;
+  jobs.run([built, modelPath, mode] { BuildModel(modelPath, mode); }, built.get());
+  jobs.runOnMainThreadAfter(*built, UploadModel, &loaded);
+
+  LoadTextures(params.textureA, params.textureB, params.textureC,
+               params.heightMapPath, params.heightMapWidth,
+               params.heightMapHeight, loaded);
+
+  // Compile while the workers are still decoding
+  LoadTerrainShaders();
 
   // Tesselation patches (quads)
   glPatchParameteri(GL_PATCH_VERTICES, 4);
+}
+
+void uploadMesh(MeshResource &mesh, const std::string &path) {
+  glGenVertexArrays(1, &mesh.vertexArrayID);
+  glBindVertexArray(mesh.vertexArrayID);
+
+  glEnableVertexAttribArray(0);
+  glGenBuffers(1, &mesh.vertexbuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexbuffer);
+  glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(glm::vec3),
+               mesh.vertices.data(), GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+
+  glEnableVertexAttribArray(1);
+  glGenBuffers(1, &mesh.uvbuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, mesh.uvbuffer);
+  glBufferData(GL_ARRAY_BUFFER, mesh.uvs.size() * sizeof(glm::vec2),
+               mesh.uvs.data(), GL_STATIC_DRAW);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void *)0);
 
-  // Use our shader
+  glEnableVertexAttribArray(2);
+  glGenBuffers(1, &mesh.normalbuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, mesh.normalbuffer);
+  glBufferData(GL_ARRAY_BUFFER, mesh.normals.size() * sizeof(glm::vec3),
+               mesh.normals.data(), GL_STATIC_DRAW);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+
+  glGenBuffers(1, &mesh.elementbuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementbuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int),
+               mesh.indices.data(), GL_STATIC_DRAW);
+  mesh.indexCount = GLsizei(mesh.indices.size());
+
+  ResourceRegistry &registry = resources();
+  registry.trackBuffer(mesh.vertexbuffer, "meshes", path + " positions",
+                       mesh.vertices.size() * sizeof(glm::vec3));
+  registry.trackBuffer(mesh.uvbuffer, "meshes", path + " uvs",
+                       mesh.uvs.size() * sizeof(glm::vec2));
+  registry.trackBuffer(mesh.normalbuffer, "meshes", path + " normals",
+                       mesh.normals.size() * sizeof(glm::vec3));
+  registry.trackBuffer(mesh.elementbuffer, "meshes", path + " indices",
+                       mesh.indices.size() * sizeof(unsigned int));
+
+  glBindVertexArray(VertexArrayID);
 
-  LoadTextures(args.textureA, args.textureB, args.textureC, args.heightMapPath);
-  LoadModel(args.modelPath, mode);
+  // The GPU has its copy, don't keep ours around
+  mesh.vertices = std::vector<glm::vec3>();
+  mesh.uvs = std::vector<glm::vec2>();
+  mesh.normals = std::vector<glm::vec3>();
+  mesh.indices = std::vector<unsigned int>();
 }
 
-void terrainPass(const glm::mat4 &MVP,
-                 const glm::mat4 &ModelMatrix,
-                 const glm::mat4 &ViewMatrix,
-                 const glm::mat3 &ModelView3x3Matrix,
-                 const glm::vec3 &lightPos,
-                 GLenum mode) {
-  // First pass: Base mesh
-  glUseProgram(terrainProgramID);
+size_t meshBytes(const MeshResource &mesh) {
+  return mesh.vertices.size() * sizeof(glm::vec3) +
+         mesh.uvs.size() * sizeof(glm::vec2) +
+         mesh.normals.size() * sizeof(glm::vec3) +
+         mesh.indices.size() * sizeof(unsigned int);
+}
+
+// Shared OBJ, parsed on a worker and uploaded on the main thread the first
+// time anything asks for it
+MeshResource &acquireMesh(const std::string &path, JobCounter &loaded) {
+  bool created;
+  MeshResource &mesh = meshCache.acquire(path, created);
+  if (!created)
+    return mesh;
+
+  JobSystem &jobs = jobSystem();
+  MeshResource *target = &mesh;
+  jobs.run([=, &jobs, &loaded] {
+    double startTime = glfwGetTime();
+    if (!loadOBJ(path.c_str(), target->vertices, target->uvs, target->normals,
+                 target->indices))
+      return;
+    size_t bytes = meshBytes(*target);
+    resources().addStaging("meshes", bytes);
+    printf("Parsed %s in %.1f ms\n", path.c_str(),
+           (glfwGetTime() - startTime) * 1000.0);
+    jobs.runOnMainThread([=] {
+      uploadMesh(*target, path);
+      resources().removeStaging("meshes", bytes);
+      recordLoadTime(path, startTime);
+    }, &loaded);
+  }, &loaded);
+  return mesh;
+}
+
+void releaseMesh(const std::string &path) {
+  meshCache.release(path, [](MeshResource &mesh) {
+    ResourceRegistry &registry = resources();
+    registry.untrackBuffer(mesh.vertexbuffer);
+    registry.untrackBuffer(mesh.uvbuffer);
+    registry.untrackBuffer(mesh.normalbuffer);
+    registry.untrackBuffer(mesh.elementbuffer);
+    glDeleteBuffers(1, &mesh.vertexbuffer);
+    glDeleteBuffers(1, &mesh.uvbuffer);
+    glDeleteBuffers(1, &mesh.normalbuffer);
+    glDeleteBuffers(1, &mesh.elementbuffer);
+    glDeleteVertexArrays(1, &mesh.vertexArrayID);
+  });
+}
+
+// Loads everything in the scene at once: every unique OBJ and texture is
+// one job, shared references just wait on the same load
+void sceneSetup(const Scene &scene, const CLIArgs &args, GLenum mode) {
+  double startTime = glfwGetTime();
+  JobSystem &jobs = jobSystem();
+  JobCounter loaded;
+
+  for (const SceneMesh &sceneMesh : scene.meshes) {
+    MeshInstance instance;
+    instance.objPath = sceneMesh.objPath;
+    instance.textureName = sceneMesh.texture;
+    instance.mesh = &acquireMesh(sceneMesh.objPath, loaded);
+    instance.texture = sceneMesh.texture != ""
+                           ? &acquireTexture(sceneMesh.texture, loaded)
+                           : nullptr;
+
+    glm::mat4 ModelMatrix = glm::translate(glm::mat4(1.0), sceneMesh.position);
+    ModelMatrix = glm::rotate(ModelMatrix, glm::radians(sceneMesh.rotation.z), glm::vec3(0, 0, 1));
+    ModelMatrix = glm::rotate(ModelMatrix, glm::radians(sceneMesh.rotation.y), glm::vec3(0, 1, 0));
+    ModelMatrix = glm::rotate(ModelMatrix, glm::radians(sceneMesh.rotation.x), glm::vec3(1, 0, 0));
+    instance.ModelMatrix = glm::scale(ModelMatrix, sceneMesh.scale);
+    meshInstances.push_back(instance);
+  }
+
+  terrainEnabled = scene.terrain;
+  if (terrainEnabled) {
+    terrainSetup(scene.terrainParams, args, mode, loaded);
+  } else {
+    // The upscale pass still rebinds this
+    glGenVertexArrays(1, &VertexArrayID);
+    glBindVertexArray(VertexArrayID);
+  }
+
+  if (!meshInstances.empty())
+    LoadShaders(meshProgramID, "src/shaders/NormalMapping.vert",
+                "src/shaders/NormalMapping.frag");
+
+  // Runs the uploads queued for this thread as they come in
+  jobs.wait(loaded);
+  if (terrainEnabled)
+    resolveTerrainTextures();
+
+  sceneLoadMs = (glfwGetTime() - startTime) * 1000.0;
+  printf("Scene loaded in %.1f ms on %d threads: %zu meshes, %zu OBJ files, "
+         "%zu textures, %ld duplicate references shared\n",
+         sceneLoadMs, jobs.workerCount() + 1,
+         meshInstances.size(), meshCache.size(), textureCache.size(),
+         meshCache.getHits() + textureCache.getHits());
+  printf("Peak memory: %.1f MB resident, %.1f MB of decoded assets at once\n",
+         peakResidentBytes() / 1048576.0,
+         resources().getPeakStagingBytes() / 1048576.0);
+}
+
+void UnloadScene() {
+  for (const MeshInstance &instance : meshInstances) {
+    releaseMesh(instance.objPath);
+    if (instance.texture)
+      releaseTexture(instance.textureName);
+  }
+  meshInstances.clear();
+  glDeleteProgram(meshProgramID);
+}
+
+void scenePass(const glm::mat4 &ProjectionMatrix,
+               const glm::mat4 &ViewMatrix,
+               const glm::vec3 &lightPos) {
+  if (meshInstances.empty())
+    return;
+
+  glUseProgram(meshProgramID);
+  GLuint MatrixID = glGetUniformLocation(meshProgramID, "MVP");
+  GLuint ViewMatrixID = glGetUniformLocation(meshProgramID, "V");
+  GLuint ModelMatrixID = glGetUniformLocation(meshProgramID, "M");
+  GLuint ModelView3x3MatrixID = glGetUniformLocation(meshProgramID, "MV3x3");
+  GLuint LightID = glGetUniformLocation(meshProgramID, "LightPosition_worldspace");
+  GLuint DiffuseTextureID = glGetUniformLocation(meshProgramID, "DiffuseTextureSampler");
+
+  glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+  glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
+  glUniform3f(glGetUniformLocation(meshProgramID, "LightColor"), lightColor.x,
+              lightColor.y, lightColor.z);
+  glUniform1f(glGetUniformLocation(meshProgramID, "LightPower"), meshLightPower);
+  lightClusters.bind(meshProgramID, clusterTextureUnit, sceneRenderSize);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(DiffuseTextureID, 0);
+
+  for (const MeshInstance &instance : meshInstances) {
+    if (instance.mesh->indexCount == 0)
+      continue;
+    glm::mat4 MVP = ProjectionMatrix * ViewMatrix * instance.ModelMatrix;
+    glm::mat3 ModelView3x3Matrix = glm::mat3(ViewMatrix * instance.ModelMatrix);
+    glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+    glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &instance.ModelMatrix[0][0]);
+    glUniformMatrix3fv(ModelView3x3MatrixID, 1, GL_FALSE, &ModelView3x3Matrix[0][0]);
+    glBindTexture(GL_TEXTURE_2D, instance.texture ? *instance.texture : 0);
+
+    glBindVertexArray(instance.mesh->vertexArrayID);
+    glDrawElements(GL_TRIANGLES, instance.mesh->indexCount, GL_UNSIGNED_INT, (void *)0);
+  }
+  glBindVertexArray(VertexArrayID);
+}
+
+void tessCacheSetup() {
+  if (tessCache.budget == 0)
+    return;
+
+  glGenTransformFeedbacks(1, &tessCache.feedback);
+  glGenBuffers(1, &tessCache.buffer);
+  glGenQueries(1, &tessCache.primitivesQuery);
+
+  // Interleaved position, uv and normal as captured from Simple.tese
+  const GLsizei stride = 8 * sizeof(float);
+  glGenVertexArrays(1, &tessCache.vertexArrayID);
+  glBindVertexArray(tessCache.vertexArrayID);
+  glBindBuffer(GL_ARRAY_BUFFER, tessCache.buffer);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *)(3 * sizeof(float)));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void *)(5 * sizeof(float)));
+  glBindVertexArray(VertexArrayID);
+}
+
+// Frees the storage behind the captured geometry, keeping the buffer name
+void releaseTessCacheStorage() {
+  if (tessCache.capacity == 0)
+    return;
+  glBindBuffer(GL_ARRAY_BUFFER, tessCache.buffer);
+  glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_COPY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  resources().untrackBuffer(tessCache.buffer);
+  tessCache.capacity = 0;
+  tessCache.valid = false;
+}
+
+// Gives the captured geometry back and tessellates every frame from now on
+void evictTessCache() {
+  releaseTessCacheStorage();
+  tessCache.budget = 0;
+}
+
+void UnloadTessCache() {
+  resources().untrackBuffer(tessCache.buffer);
+  glDeleteProgram(tessCache.programID);
+  glDeleteTransformFeedbacks(1, &tessCache.feedback);
+  glDeleteBuffers(1, &tessCache.buffer);
+  glDeleteQueries(1, &tessCache.primitivesQuery);
+  glDeleteVertexArrays(1, &tessCache.vertexArrayID);
+}
 
-  GLuint HeightMapTexutreID = glGetUniformLocation(terrainProgramID, "HeightMapTextureSampler");
-  GLuint TextureAID = glGetUniformLocation(terrainProgramID, "TextureASampler");
-  GLuint TextureBID = glGetUniformLocation(terrainProgramID, "TextureBSampler");
-  GLuint TextureCID = glGetUniformLocation(terrainProgramID, "TextureCSampler");
-  GLuint TextureASpecularMapID = glGetUniformLocation(terrainProgramID, "TextureASpecularMapSampler");
-  GLuint TextureBSpecularMapID = glGetUniformLocation(terrainProgramID, "TextureBSpecularMapSampler");
-  GLuint TextureCSpecularMapID = glGetUniformLocation(terrainProgramID, "TextureCSpecularMapSampler");
+// Binds the terrain textures and uniforms, shared by the tessellation
+// program and the cached redraw
+void setTerrainUniforms(GLuint programID,
+                        const glm::mat4 &MVP,
+                        const glm::mat4 &ModelMatrix,
+                        const glm::mat4 &ViewMatrix,
+                        const glm::mat3 &ModelView3x3Matrix,
+                        const glm::vec3 &lightPos) {
+  glUseProgram(programID);
+
+  GLuint HeightMapTexutreID = glGetUniformLocation(programID, "HeightMapTextureSampler");
+  GLuint TextureAID = glGetUniformLocation(programID, "TextureASampler");
+  GLuint TextureBID = glGetUniformLocation(programID, "TextureBSampler");
+  GLuint TextureCID = glGetUniformLocation(programID, "TextureCSampler");
+  GLuint TextureASpecularMapID = glGetUniformLocation(programID, "TextureASpecularMapSampler");
+  GLuint TextureBSpecularMapID = glGetUniformLocation(programID, "TextureBSpecularMapSampler");
+  GLuint TextureCSpecularMapID = glGetUniformLocation(programID, "TextureCSpecularMapSampler");
 
   // Set textures
   // Heightmap
@@ -680,55 +1328,687 @@ void terrainPass(const glm::mat4 &MVP,
   glUniform1i(TextureCSpecularMapID, 6);
 
   // Get a handle for our uniforms
-  GLuint HeightMapSizeID = glGetUniformLocation(terrainProgramID, "HeightMapSize");
-  GLuint HeightMapUVStepSizeID = glGetUniformLocation(terrainProgramID, "HeightMapUVStepSize");
-  GLuint HeightScaleID = glGetUniformLocation(terrainProgramID, "HeightScale");
-  GLuint BandAID = glGetUniformLocation(terrainProgramID, "BandA");
-  GLuint BandBID = glGetUniformLocation(terrainProgramID, "BandB");
-  GLuint BandSizesID = glGetUniformLocation(terrainProgramID, "BandSizes");
-  GLuint MatrixID = glGetUniformLocation(terrainProgramID, "MVP");
-  GLuint ViewMatrixID = glGetUniformLocation(terrainProgramID, "V");
-  GLuint ModelMatrixID = glGetUniformLocation(terrainProgramID, "M");
-  GLuint ModelView3x3MatrixID = glGetUniformLocation(terrainProgramID, "MV3x3");
-  GLuint LightID = glGetUniformLocation(terrainProgramID, "LightPosition_worldspace");
+  GLuint HeightMapSizeID = glGetUniformLocation(programID, "HeightMapSize");
+  GLuint HeightMapUVStepSizeID = glGetUniformLocation(programID, "HeightMapUVStepSize");
+  GLuint HeightMapRangeID = glGetUniformLocation(programID, "HeightMapRange");
+  GLuint HeightScaleID = glGetUniformLocation(programID, "HeightScale");
+  GLuint GridPointsID = glGetUniformLocation(programID, "GridPoints");
+  GLuint GridScaleID = glGetUniformLocation(programID, "GridScale");
+  GLuint TessLevelID = glGetUniformLocation(programID, "TessLevel");
+  GLuint BandAID = glGetUniformLocation(programID, "BandA");
+  GLuint BandBID = glGetUniformLocation(programID, "BandB");
+  GLuint BandSizesID = glGetUniformLocation(programID, "BandSizes");
+  GLuint MatrixID = glGetUniformLocation(programID, "MVP");
+  GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
+  GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
+  GLuint ModelView3x3MatrixID = glGetUniformLocation(programID, "MV3x3");
+  GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
 
   // Send our transformation to the currently bound shader,
   glUniform2i(HeightMapSizeID, heightMapSize.x, heightMapSize.y);
   glUniform2f(HeightMapUVStepSizeID, heightMapUVStepSize.x, heightMapUVStepSize.y);
-  glUniform1f(HeightScaleID, m_scale);
-  glUniform1f(BandAID, m_band_a);
-  glUniform1f(BandBID, m_band_b);
-  glUniform1f(BandSizesID, m_band_sizes);
+  glUniform1f(HeightMapRangeID, heightMapRange);
+  glUniform1f(HeightScaleID, terrainParams.scale);
+  glUniform1i(GridPointsID, n_points);
+  glUniform1f(GridScaleID, terrainParams.scale);
+  glUniform1f(TessLevelID, tessLevel);
+  glUniform1f(BandAID, terrainParams.bandA);
+  glUniform1f(BandBID, terrainParams.bandB);
+  glUniform1f(BandSizesID, terrainParams.bandSizes);
   glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
   glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
   glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
   glUniformMatrix3fv(ModelView3x3MatrixID, 1, GL_FALSE,
                      &ModelView3x3Matrix[0][0]);
 
-  // Set the light position
+  // Set the lights
   glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
+  glUniform3f(glGetUniformLocation(programID, "LightColor"), lightColor.x,
+              lightColor.y, lightColor.z);
+  glUniform1f(glGetUniformLocation(programID, "LightPower"), terrainLightPower);
+  lightClusters.bind(programID, clusterTextureUnit, sceneRenderSize);
+}
 
+size_t terrainPatchCount(GLenum mode) {
+  if (mode != GL_PATCHES)
+    return 0;
+  if (proceduralTerrain)
+    return size_t(n_points - 1) * size_t(n_points - 1);
+  return indices.size() / 4;
+}
+
+void drawTerrainGeometry(GLenum mode) {
+  if (proceduralTerrain) {
+    // One instance per patch, 4 corners each
+    glDrawArraysInstanced(mode, 0, 4, (n_points - 1) * (n_points - 1));
+    return;
+  }
+  glDrawElements(mode,                    // mode
+                 (GLsizei)indices.size(), // count
+                 GL_UNSIGNED_INT,         // type
+                 (void *)0                // element array buffer offset
+  );
+}
+
+// Runs the tessellation stages once with rasterisation off and keeps their
+// output. Returns false if the cache can't be used for the current key.
+bool captureTessellation(const glm::mat4 &ViewMatrix,
+                         const glm::vec3 &lightPos,
+                         GLenum mode) {
+  bool keyChanged = tessCache.tessLevel != tessLevel ||
+                    tessCache.heightMapVersion != heightMapVersion ||
+                    tessCache.shaderVersion != terrainShaderVersion;
+  if (!keyChanged && (tessCache.valid || tessCache.overBudget))
+    return tessCache.valid;
+
+  tessCache.valid = false;
+  tessCache.overBudget = false;
+  tessCache.tessLevel = tessLevel;
+  tessCache.heightMapVersion = heightMapVersion;
+  tessCache.shaderVersion = terrainShaderVersion;
+
+  // fractional_even_spacing rounds each edge up to an even segment count,
+  // a quad patch then makes 2 * n * n triangles
+  int segments = std::max(2, int(std::ceil(tessLevel / 2.0f)) * 2);
+  size_t triangles = terrainPatchCount(mode) * 2 * segments * segments;
+  size_t bytes = triangles * 3 * 8 * sizeof(float);
+  if (bytes == 0 || bytes > tessCache.budget) {
+    // The old capture is stale, don't hold on to its memory
+    releaseTessCacheStorage();
+    printf("Tessellation cache declined: %zu patches at level %.0f need "
+           "%.1f MB, the budget is %.1f MB, tessellating every frame\n",
+           terrainPatchCount(mode), tessLevel, bytes / 1048576.0,
+           tessCache.budget / 1048576.0);
+    tessCache.overBudget = true;
+    return false;
+  }
+
+  if (bytes > tessCache.capacity) {
+    glBindBuffer(GL_ARRAY_BUFFER, tessCache.buffer);
+    glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STATIC_COPY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    tessCache.capacity = bytes;
+    resources().trackBuffer(tessCache.buffer, "tesscache", "captured terrain", bytes);
+  }
+
+  // Identity model matrix so the captured positions stay in model space
+  glm::mat4 identity(1.0);
+  setTerrainUniforms(terrainProgramID, identity, identity, ViewMatrix,
+                     glm::mat3(ViewMatrix), lightPos);
+
+  glEnable(GL_RASTERIZER_DISCARD);
+  glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tessCache.feedback);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, tessCache.buffer);
+  glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, tessCache.primitivesQuery);
+  glBeginTransformFeedback(GL_TRIANGLES);
+  drawTerrainGeometry(mode);
+  glEndTransformFeedback();
+  glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+  glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+  glDisable(GL_RASTERIZER_DISCARD);
+
+  // Only read back on a miss, so the stall is rare
+  GLuint written = 0;
+  glGetQueryObjectuiv(tessCache.primitivesQuery, GL_QUERY_RESULT, &written);
+  tessCache.primitives = written;
+  tessCache.misses++;
+  // Nothing in the key depends on the view, so an empty capture stays right
+  // until the key changes. Keep it rather than capturing again every frame.
+  tessCache.valid = true;
+  printf("Tessellation cache captured %u triangles (%.1f MB) at level %.0f\n",
+         written, bytes / 1048576.0, tessLevel);
+  return true;
+}
+
+void terrainPass(const glm::mat4 &MVP,
+                 const glm::mat4 &ModelMatrix,
+                 const glm::mat4 &ViewMatrix,
+                 const glm::mat3 &ModelView3x3Matrix,
+                 const glm::vec3 &lightPos,
+                 GLenum mode) {
   if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
   } else {
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
   }
 
+  if (tessCache.budget > 0) {
+    long misses = tessCache.misses;
+    if (captureTessellation(ViewMatrix, lightPos, mode)) {
+      if (misses == tessCache.misses)
+        tessCache.hits++;
+      // Redraw the captured triangles, no tessellation this frame
+      setTerrainUniforms(tessCache.programID, MVP, ModelMatrix, ViewMatrix,
+                         ModelView3x3Matrix, lightPos);
+      glBindVertexArray(tessCache.vertexArrayID);
+      glDrawTransformFeedback(GL_TRIANGLES, tessCache.feedback);
+      glBindVertexArray(VertexArrayID);
+      return;
+    }
+  }
+
+  // First pass: Base mesh
+  setTerrainUniforms(terrainProgramID, MVP, ModelMatrix, ViewMatrix,
+                     ModelView3x3Matrix, lightPos);
+
   // Draw the triangles !
-  glDrawElements(mode,                    // mode
-                 (GLsizei)indices.size(), // count
-                 GL_UNSIGNED_INT,         // type
-                 (void *)0                // element array buffer offset
-  );
+  drawTerrainGeometry(mode);
+}
+
+void renderTargetSetup(float maxScale) {
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  sceneTargetSize = glm::ivec2(int(width * maxScale), int(height * maxScale));
+  sceneRenderSize = sceneTargetSize;
+
+  glGenTextures(1, &sceneColorTexture);
+  glBindTexture(GL_TEXTURE_2D, sceneColorTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, sceneTargetSize.x, sceneTargetSize.y,
+               0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenRenderbuffers(1, &sceneDepthRenderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, sceneDepthRenderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+                        sceneTargetSize.x, sceneTargetSize.y);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  resources().trackTexture(sceneColorTexture, "render target", "scene colour");
+  resources().trackRenderbuffer(sceneDepthRenderbuffer, "render target",
+                                "scene depth", GL_DEPTH_COMPONENT24,
+                                sceneTargetSize.x, sceneTargetSize.y);
+
+  glGenFramebuffers(1, &sceneFramebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         sceneColorTexture, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, sceneDepthRenderbuffer);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    printf("Scene framebuffer is incomplete\n");
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  glGenQueries(n_timer_queries, sceneTimerQueries);
+
+  LoadShaders(upscaleProgramID, "src/shaders/Upscale.vert",
+              "src/shaders/Upscale.frag");
+  // Core profile needs a VAO bound even though the triangle has no attributes
+  glGenVertexArrays(1, &upscaleVertexArrayID);
+
+  printf("Render target %dx%d (resolution scale %.2f)\n", sceneTargetSize.x,
+         sceneTargetSize.y, maxScale);
+}
+
+void UnloadRenderTarget() {
+  glDeleteQueries(n_timer_queries, sceneTimerQueries);
+  resources().untrackTexture(sceneColorTexture);
+  resources().untrackRenderbuffer(sceneDepthRenderbuffer);
+  glDeleteFramebuffers(1, &sceneFramebuffer);
+  glDeleteRenderbuffers(1, &sceneDepthRenderbuffer);
+  glDeleteTextures(1, &sceneColorTexture);
+  glDeleteVertexArrays(1, &upscaleVertexArrayID);
+  glDeleteProgram(upscaleProgramID);
+}
+
+// Scatters count small lights over the terrain. Their radius shrinks as
+// the count grows so each spot of ground is lit by a few of them whatever
+// the count, which keeps the sweep about shading cost rather than coverage.
+void makePointLights(int count) {
+  float extent = n_points * terrainParams.scale;
+  float radius = std::max(0.15f, extent * std::sqrt(3.0f / (3.14159f * std::max(1, count))));
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  pointLights.resize(count);
+  pointLightHomes.resize(count);
+  for (int i = 0; i < count; i++) {
+    pointLightHomes[i] = glm::vec4((unit(random) - 0.5f) * extent,
+                                   0.2f + unit(random) * 3.0f,
+                                   (unit(random) - 0.5f) * extent,
+                                   unit(random) * 6.2832f);
+    pointLights[i].radius = radius;
+    // Saturated colours, so overlapping lights stay visible
+    glm::vec3 hue = glm::clamp(glm::abs(glm::mod(unit(random) * 6.0f + glm::vec3(0, 4, 2),
+                                                 6.0f) - 3.0f) - 1.0f,
+                               0.0f, 1.0f);
+    pointLights[i].color = hue;
+    pointLights[i].power = 2.0f;
+  }
+}
+
+void animatePointLights(double time) {
+  float drift = pointLights.empty() ? 0.0f : 0.5f * pointLights[0].radius;
+  for (size_t i = 0; i < pointLights.size(); i++) {
+    glm::vec4 home = pointLightHomes[i];
+    float angle = float(time) * 0.7f + home.w;
+    pointLights[i].position = glm::vec3(home) + drift * glm::vec3(std::cos(angle),
+                                                                  0.5f * std::sin(2.0f * angle),
+                                                                  std::sin(angle));
+  }
+}
+
+void lightingSetup(int count) {
+  lightClusters.setup();
+  makePointLights(count);
+}
+
+void UnloadLighting() { lightClusters.unload(); }
+
+// Steps through lightSweepCounts, averaging frame, GPU and clustering time
+// over lightSweepFrames frames per count. Returns false once it's done.
+struct LightSweep {
+  size_t step = 0;
+  int frame = 0;
+  double startTime = 0;
+  double gpuMs = 0;
+  int gpuSamples = 0;
+  double clusterMs = 0;
+  double references = 0;
+  size_t dropped = 0;
+};
+
+bool lightSweepFrame(LightSweep &sweep, double gpuMs) {
+  const size_t steps = sizeof(lightSweepCounts) / sizeof(lightSweepCounts[0]);
+  if (sweep.frame == 0) {
+    if (sweep.step == 0)
+      printf("lights  frame ms  GPU ms  cluster ms  refs/froxel  dropped\n");
+    makePointLights(lightSweepCounts[sweep.step]);
+  }
+  sweep.frame++;
+  if (sweep.frame == lightSweepWarmup)
+    sweep = LightSweep{sweep.step, sweep.frame, glfwGetTime()};
+  if (sweep.frame <= lightSweepWarmup)
+    return true;
+
+  if (gpuMs >= 0.0) {
+    sweep.gpuMs += gpuMs;
+    sweep.gpuSamples++;
+  }
+  sweep.clusterMs += lightClusters.getUpdateMs();
+  sweep.references += double(lightClusters.getReferenceCount()) / lightClusters.getClusterCount();
+  sweep.dropped += lightClusters.getDroppedCount();
+
+  if (sweep.frame < lightSweepWarmup + lightSweepFrames)
+    return true;
+
+  printf("%6d  %8.2f  %6.2f  %10.3f  %11.2f  %7zu\n", lightSweepCounts[sweep.step],
+         (glfwGetTime() - sweep.startTime) * 1000.0 / lightSweepFrames,
+         sweep.gpuSamples > 0 ? sweep.gpuMs / sweep.gpuSamples : 0.0,
+         sweep.clusterMs / lightSweepFrames, sweep.references / lightSweepFrames,
+         sweep.dropped / lightSweepFrames);
+  sweep = LightSweep{sweep.step + 1};
+  return sweep.step < steps;
+}
+
+// Draws everything from the current camera into the bound target
+void renderScene(const glm::vec3 &lightPos, GLenum mode, double time) {
+  // Clear the screen
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glm::mat4 ProjectionMatrix = getProjectionMatrix();
+  glm::mat4 ViewMatrix = getViewMatrix();
+  glm::mat4 ModelMatrix = glm::mat4(1.0);
+  glm::mat4 ModelViewMatrix = ViewMatrix * ModelMatrix;
+  glm::mat3 ModelView3x3Matrix = glm::mat3(ModelViewMatrix);
+  glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
+
+  animatePointLights(time);
+  lightClusters.update(pointLights, ViewMatrix, ProjectionMatrix);
+
+  if (terrainEnabled)
+    terrainPass(MVP, ModelMatrix, ViewMatrix, ModelView3x3Matrix, lightPos, mode);
+  scenePass(ProjectionMatrix, ViewMatrix, lightPos);
+}
+
+// Returns the GPU time of the oldest frame in flight, or -1 if it isn't ready
+double beginScenePass(float scale) {
+  double gpuMs = -1.0;
+  GLuint query = sceneTimerQueries[sceneTimerFrame % n_timer_queries];
+  if (sceneTimerFrame >= n_timer_queries) {
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+      gpuMs = double(elapsed) / 1e6;
+    }
+  }
+
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  sceneRenderSize = glm::ivec2(
+      std::max(1, std::min(sceneTargetSize.x, int(width * scale))),
+      std::max(1, std::min(sceneTargetSize.y, int(height * scale))));
+
+  glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+  glViewport(0, 0, sceneRenderSize.x, sceneRenderSize.y);
+  glBeginQuery(GL_TIME_ELAPSED, query);
+  return gpuMs;
+}
+
+void endScenePass() {
+  glEndQuery(GL_TIME_ELAPSED);
+  sceneTimerFrame++;
+}
+
+void upscalePass() {
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, width, height);
+  glDisable(GL_DEPTH_TEST);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+  glUseProgram(upscaleProgramID);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, sceneColorTexture);
+  glUniform1i(glGetUniformLocation(upscaleProgramID, "SceneTextureSampler"), 0);
+  glm::vec2 renderScale(float(sceneRenderSize.x) / float(sceneTargetSize.x),
+                        float(sceneRenderSize.y) / float(sceneTargetSize.y));
+  glUniform2f(glGetUniformLocation(upscaleProgramID, "RenderScale"),
+              renderScale.x, renderScale.y);
+  // Sharpen more the further we are below native resolution
+  float upscale = float(width) / float(sceneRenderSize.x);
+  glUniform1f(glGetUniformLocation(upscaleProgramID, "Sharpness"),
+              std::min(1.0f, std::max(0.0f, (upscale - 1.0f) * 0.5f)));
+
+  glBindVertexArray(upscaleVertexArrayID);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(VertexArrayID);
+
+  glEnable(GL_DEPTH_TEST);
+}
+
+// Halves the largest material texture that still has mips, swapping the new
+// texture into the cache. Returns what it dropped, id 0 when nothing could
+// be.
+Resource dropMaterialMip() {
+  ResourceRegistry &registry = resources();
+  Resource texture = registry.largestMipmappedTexture("materials");
+  if (texture.id == 0)
+    return texture;
+  GLuint textureID = registry.dropTopMip(texture.id);
+  if (textureID == texture.id)
+    return Resource();
+  *textureCache.find(texture.name) = textureID;
+  if (terrainEnabled)
+    resolveTerrainTextures();
+  return texture;
+}
+
+// Frees GPU memory until the tracked total fits under -budget. The
+// tessellation cache goes first since it only saves work, then the top mip
+// of the largest material texture, one at a time.
+void enforceBudget() {
+  ResourceRegistry &registry = resources();
+  if (gpuBudget == 0 || registry.getGpuBytes() <= gpuBudget)
+    return;
+
+  if (tessCache.capacity > 0) {
+    evictTessCache();
+    printf("Over the %.1f MB budget, dropped the tessellation cache\n",
+           gpuBudget / 1048576.0);
+  }
+
+  while (registry.getGpuBytes() > gpuBudget) {
+    Resource texture = dropMaterialMip();
+    if (texture.id == 0)
+      break;
+    printf("Over the %.1f MB budget, %s drops to %dx%d\n", gpuBudget / 1048576.0,
+           texture.name.c_str(), std::max(1, texture.width / 2),
+           std::max(1, texture.height / 2));
+  }
+
+  if (registry.getGpuBytes() > gpuBudget) {
+    printf("Still %.1f MB over the budget with nothing left to drop\n",
+           (registry.getGpuBytes() - gpuBudget) / 1048576.0);
+    // Don't try again every second
+    gpuBudget = 0;
+  }
+}
+
+void UnloadAll() {
+  UnloadLighting();
+  UnloadRenderTarget();
+  UnloadTessCache();
+  UnloadScene();
+  UnloadModel();
+  if (terrainEnabled)
+    UnloadTextures();
+  UnloadShaders();
+
+  // Close OpenGL window and terminate GLFW
+  glfwTerminate();
+
+  resources().printReport();
+}
+
+// Fixed views for -regress, chosen to cover the texture bands, grazing
+// angles where tessellation matters most, and a straight down view
+struct RegressView {
+  const char *name;
+  glm::vec3 position;
+  float horizontalAngle;
+  float verticalAngle;
+};
+static const RegressView regressViews[] = {
+    {"overview", glm::vec3(0, 10, -10), 0.0f, -0.7f},
+    {"grazing", glm::vec3(-5, 3, -5), 0.785f, -0.2f},
+    {"topdown", glm::vec3(0, 15, 0), 0.0f, -1.5f},
+    {"closeup", glm::vec3(2, 2.5f, 2), 3.93f, -0.4f},
+};
+static const int regressWarmupFrames = 5;
+static const int regressFrames = 20;
+
+// Measurement keys can't hold whitespace
+std::string regressKey(std::string name) {
+  std::replace(name.begin(), name.end(), ' ', '_');
+  return name;
+}
+
+// Checks value against the stored baseline, allowing it to grow by ratio
+// plus slack. With twoSided it may not shrink by as much either, for counts
+// where a drop means something went missing. Prints the line for the report
+// and returns false on a regression.
+bool regressCheck(const Baseline &baseline, Baseline &measured,
+                  const std::string &key, double value, double ratio,
+                  double slack, bool twoSided = false) {
+  measured.set(key, value);
+  if (!baseline.has(key)) {
+    printf("  NEW   %-32s %10.3f\n", key.c_str(), value);
+    return true;
+  }
+  double reference = baseline.get(key, 0.0);
+  double limit = reference * ratio + slack;
+  bool ok = value <= limit;
+  if (twoSided) {
+    double lower = reference / ratio - slack;
+    ok &= value >= lower;
+    printf("  %s  %-32s %10.3f  baseline %10.3f  range %.3f-%.3f\n",
+           ok ? "ok  " : "FAIL", key.c_str(), value, reference, lower, limit);
+    return ok;
+  }
+  printf("  %s  %-32s %10.3f  baseline %10.3f  limit %10.3f\n",
+         ok ? "ok  " : "FAIL", key.c_str(), value, reference, limit);
+  return ok;
+}
+
+// Renders every regression view offscreen, compares it with its golden
+// image and checks frame time, primitive counts and load times against the
+// baseline. With update set it writes new goldens and a new baseline
+// instead. Returns the process exit code.
+int runRegression(const std::string &dir, bool update,
+                  const glm::vec3 &lightPos, GLenum mode) {
+  printf("Regression run on %s\n", (const char *)glGetString(GL_RENDERER));
+  std::string baselinePath = dir + "/baseline.txt";
+  Baseline baseline;
+  if (!baseline.load(baselinePath.c_str()) && !update) {
+    printf("No baseline at %s, run with -regress-update first\n",
+           baselinePath.c_str());
+    return 1;
+  }
+
+  // Thresholds live in the baseline file so they can be tuned per machine
+  Baseline measured;
+  // An update only records, so its checks run against an empty baseline and
+  // every value is reported as new
+  Baseline none;
+  const Baseline &reference = update ? none : baseline;
+  bool written = true;
+  const char *thresholdKeys[] = {"threshold.time_ratio", "threshold.time_slack_ms",
+                                 "threshold.load_slack_ms", "threshold.primitives_ratio",
+                                 "threshold.mean_delta_e", "threshold.different_pixels"};
+  const double thresholdDefaults[] = {1.25, 0.5, 5.0, 1.02, 1.0, 0.005};
+  for (int i = 0; i < 6; i++)
+    measured.set(thresholdKeys[i], baseline.get(thresholdKeys[i], thresholdDefaults[i]));
+  double timeRatio = measured.get("threshold.time_ratio", 0);
+  double timeSlack = measured.get("threshold.time_slack_ms", 0);
+  double loadSlack = measured.get("threshold.load_slack_ms", 0);
+  double primitivesRatio = measured.get("threshold.primitives_ratio", 0);
+  double maxMeanDeltaE = measured.get("threshold.mean_delta_e", 0);
+  double maxDifferent = measured.get("threshold.different_pixels", 0);
+
+  bool passed = true;
+  GLuint primitivesQuery;
+  glGenQueries(1, &primitivesQuery);
+  for (const RegressView &view : regressViews) {
+    printf("%s\n", view.name);
+    setCamera(view.position, view.horizontalAngle, view.verticalAngle);
+
+    double totalMs = 0.0;
+    GLuint primitives = 0;
+    for (int frame = 0; frame < regressWarmupFrames + regressFrames; frame++) {
+      double startTime = glfwGetTime();
+      beginScenePass(1.0f);
+      glBeginQuery(GL_PRIMITIVES_GENERATED, primitivesQuery);
+      // Lights frozen at time zero so every run sees the same image
+      renderScene(lightPos, mode, 0.0);
+      glEndQuery(GL_PRIMITIVES_GENERATED);
+      endScenePass();
+      glFinish();
+      if (frame >= regressWarmupFrames)
+        totalMs += (glfwGetTime() - startTime) * 1000.0;
+      glGetQueryObjectuiv(primitivesQuery, GL_QUERY_RESULT, &primitives);
+    }
+
+    // Read back the scene target, flipped to top-down rows for the PPM
+    int width = sceneRenderSize.x;
+    int height = sceneRenderSize.y;
+    std::vector<uint8_t> pixels(size_t(width) * height * 3);
+    std::vector<uint8_t> image(pixels.size());
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+    GLint packAlignment;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    for (int y = 0; y < height; y++)
+      memcpy(&image[size_t(y) * width * 3],
+             &pixels[size_t(height - 1 - y) * width * 3], size_t(width) * 3);
+
+    std::string goldenPath = dir + "/" + view.name + ".ppm";
+    if (update) {
+      written &= writePPM(goldenPath.c_str(), width, height, image);
+    } else {
+      int goldenWidth, goldenHeight;
+      std::vector<uint8_t> golden;
+      if (!readPPM(goldenPath.c_str(), goldenWidth, goldenHeight, golden)) {
+        printf("  FAIL  missing golden image %s\n", goldenPath.c_str());
+        passed = false;
+      } else if (goldenWidth != width || goldenHeight != height) {
+        printf("  FAIL  golden image is %dx%d, rendered %dx%d\n", goldenWidth,
+               goldenHeight, width, height);
+        passed = false;
+      } else {
+        ImageDiff diff = compareImages(golden, image, width, height);
+        bool ok = diff.meanDeltaE <= maxMeanDeltaE &&
+                  diff.differentFraction <= maxDifferent;
+        printf("  %s  image: mean dE %.3f, max dE %.1f, %.3f%% visibly different\n",
+               ok ? "ok  " : "FAIL", diff.meanDeltaE, diff.maxDeltaE,
+               diff.differentFraction * 100.0);
+        if (!ok) {
+          std::string failedPath = dir + "/" + view.name + ".failed.ppm";
+          writePPM(failedPath.c_str(), width, height, image);
+          printf("        wrote %s\n", failedPath.c_str());
+          passed = false;
+        }
+      }
+    }
+
+    std::string name = view.name;
+    passed &= regressCheck(reference, measured, name + ".frame_ms",
+                           totalMs / regressFrames, timeRatio, timeSlack);
+    passed &= regressCheck(reference, measured, name + ".primitives",
+                           primitives, primitivesRatio, 0.0, true);
+  }
+  glDeleteQueries(1, &primitivesQuery);
+
+  // The -budget path has to be able to shrink the default materials, which
+  // are BMPs. Runs after the views so the goldens are unaffected.
+  printf("budget\n");
+  if (resources().largestMipmappedTexture("materials").id != 0) {
+    double before = double(resources().getGpuBytes());
+    Resource texture = dropMaterialMip();
+    double freed = before - double(resources().getGpuBytes());
+    bool ok = texture.id != 0 && freed > 0.0;
+    printf("  %s  dropping the top mip of %s frees %.2f MB\n",
+           ok ? "ok  " : "FAIL", ok ? texture.name.c_str() : "a material",
+           freed / 1048576.0);
+    passed &= ok;
+  }
+
+  printf("loading\n");
+  for (const auto &asset : assetLoadMs)
+    passed &= regressCheck(reference, measured, "load." + regressKey(asset.first) + "_ms",
+                           asset.second, timeRatio, loadSlack);
+  passed &= regressCheck(reference, measured, "load.scene_ms", sceneLoadMs,
+                         timeRatio, loadSlack);
+
+  if (update) {
+    if (!written || !measured.save(baselinePath.c_str()))
+      return 1;
+    printf("Wrote goldens and baseline to %s\n", dir.c_str());
+    return 0;
+  }
+  printf(passed ? "PASSED\n" : "FAILED\n");
+  return passed ? 0 : 1;
 }
 
 int main(int argc, char *argv[]) {
+  // Start the workers, this thread stays the one owning the GL context
+  jobSystem();
+
   // Process CLI arguments
   CLIArgs args = processCLIArgs(argc, argv);
+#ifdef REGRESS_TARGET
+  // The regress build always runs the harness, on regress/ unless told
+  // otherwise
+  if (args.regressDir == "")
+    args.regressDir = "regress";
+#endif
+  Scene scene;
+  scene.terrainParams = args.terrain;
+  if (args.scenePath != "" && !loadSceneFile(args.scenePath.c_str(), scene))
+    return -1;
   const static GLenum mode = GL_PATCHES;
 
   // Initialize and create a window.
-  if (initializeGLFW() != 0)
+  if (args.regressDir != "") {
+#ifndef _WIN32
+    // Mesa's llvmpipe, so goldens match on any box, GPU or not. Set either
+    // variable beforehand to pick something else.
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+    setenv("GALLIUM_DRIVER", "llvmpipe", 0);
+#endif
+  }
+  if (initializeGLFW(args.regressDir == "") != 0)
     return -1;
 
   // Gray background
@@ -740,13 +2020,34 @@ int main(int argc, char *argv[]) {
   // Cull triangles which normal is not towards the camera
   glEnable(GL_CULL_FACE);
 
-  terrainSetup(args, mode);
+  sceneSetup(scene, args, mode);
+  tessCacheSetup();
+  renderTargetSetup(args.maxResolutionScale);
+  lightingSetup(args.pointLights);
+  gpuBudget = size_t(std::max(0, args.budgetMB)) << 20;
+  enforceBudget();
+  // The sweep measures full resolution frames, so don't let the scale move
+  ResolutionController resolution(
+      args.lightSweep ? args.maxResolutionScale : args.minResolutionScale,
+      args.maxResolutionScale, args.targetFrameMs);
+  LightSweep lightSweep;
 
   // Our light position is fixed
   glm::vec3 lightPos = glm::vec3(0, -0.5, -0.5);
   //	glm::vec3 lightPos = glm::vec3(0, 4, 4);
 
+  if (args.regressDir != "") {
+    int result = runRegression(args.regressDir, args.regressUpdate, lightPos, mode);
+    UnloadAll();
+    return result;
+  }
+
+  FramePacer pacer(args.swapInterval, args.framesInFlight, args.lateInput);
+  pacer.setup();
+
   bool reloadShaders = false;
+  bool memorySummary = false;
+  int tessLevelKey = 0;
   // For speed computation
   double lastTime = glfwGetTime();
   int nbFrames = 0;
@@ -757,50 +2058,94 @@ int main(int argc, char *argv[]) {
     }
     if (reloadShaders && glfwGetKey(window, GLFW_KEY_S) == GLFW_RELEASE) {
       UnloadShaders();
-      LoadShaders(terrainProgramID, "src/shaders/Simple.vert", "src/shaders/Simple.frag",
-                  "src/shaders/Simple.tesc", "src/shaders/Simple.tese");
+      LoadTerrainShaders();
       reloadShaders = false;
     }
 
+    // M prints where the memory goes
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS) {
+      memorySummary = true;
+    }
+    if (memorySummary && glfwGetKey(window, GLFW_KEY_M) == GLFW_RELEASE) {
+      resources().printSummary(10);
+      memorySummary = false;
+    }
+
+    // [ and ] step the tessellation level, on release
+    if (glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS) {
+      tessLevelKey = -2;
+    } else if (glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS) {
+      tessLevelKey = 2;
+    } else if (tessLevelKey != 0) {
+      tessLevel = std::min(64.0f, std::max(2.0f, tessLevel + tessLevelKey));
+      printf("Tessellation level %.0f\n", tessLevel);
+      tessLevelKey = 0;
+    }
+
     // Measure speed
     double currentTime = glfwGetTime();
     nbFrames++;
     if (currentTime - lastTime >=
         1.0) { // If last prinf() was more than 1sec ago
       // printf and reset
-      printf("%f ms/frame\n", 1000.0 / double(nbFrames));
+      printf("%f ms/frame, %f ms GPU, resolution scale %.2f (%dx%d)\n",
+             1000.0 / double(nbFrames), resolution.getSmoothedMs(),
+             resolution.getScale(), sceneRenderSize.x, sceneRenderSize.y);
+      if (!pointLights.empty()) {
+        printf("%zu point lights: clustering %.2f ms, %.1f lights per cluster, "
+               "%zu dropped\n",
+               pointLights.size(), lightClusters.getUpdateMs(),
+               double(lightClusters.getReferenceCount()) / lightClusters.getClusterCount(),
+               lightClusters.getDroppedCount());
+      }
+      if (tessCache.budget > 0) {
+        long lookups = tessCache.hits + tessCache.misses;
+        printf("tessellation cache: %ld hits, %ld misses, %.1f%% hit rate, "
+               "%zu triangles\n",
+               tessCache.hits, tessCache.misses,
+               lookups > 0 ? 100.0 * tessCache.hits / lookups : 0.0,
+               tessCache.primitives);
+      }
+      if (pacer.isConfigured()) {
+        printf("latency %.2f ms, %.2f ms max, %.2f ms/frame waiting on fences\n",
+               pacer.getMeanLatencyMs(), pacer.getMaxLatencyMs(),
+               pacer.getMeanWaitMs());
+      }
+      pacer.resetStats();
+      enforceBudget();
       nbFrames = 0;
       lastTime += 1.0;
     }
 
-    // Clear the screen
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // Compute the MVP matrix from keyboard and mouse input
+    // Wait for a frame slot, then compute the MVP matrix from keyboard and
+    // mouse input, as late as the pacer allows. Sampled before the scene
+    // pass so the wait doesn't count as GPU time.
+    setInputSampleDeadline(pacer.beginFrame());
     computeMatricesFromInputs();
-    glm::mat4 ProjectionMatrix = getProjectionMatrix();
-    glm::mat4 ViewMatrix = getViewMatrix();
-    glm::mat4 ModelMatrix = glm::mat4(1.0);
-    glm::mat4 ModelViewMatrix = ViewMatrix * ModelMatrix;
-    glm::mat3 ModelView3x3Matrix = glm::mat3(ModelViewMatrix);
-    glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
 
-    terrainPass(MVP, ModelMatrix, ViewMatrix, ModelView3x3Matrix, lightPos, mode);
+    // Render into the offscreen target at the current resolution scale
+    double gpuMs = beginScenePass(resolution.getScale());
+    resolution.update(gpuMs);
+
+    renderScene(lightPos, mode, currentTime);
+
+    endScenePass();
+    upscalePass();
+    pacer.endFrame(getInputSampleTime());
 
     // Swap buffers
     glfwSwapBuffers(window);
+    pacer.markSwap();
     glfwPollEvents();
 
+    if (args.lightSweep && !lightSweepFrame(lightSweep, gpuMs))
+      break;
+
   } // Check if the ESC key was pressed or the window was closed
   while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
          glfwWindowShouldClose(window) == 0);
 
-  UnloadModel();
-  UnloadTextures();
-  UnloadShaders();
-
-  // Close OpenGL window and terminate GLFW
-  glfwTerminate();
-
+  pacer.unload();
+  UnloadAll();
   return 0;
 }
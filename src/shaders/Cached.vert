@@ -0,0 +1,40 @@
+#version 330 core
+
+// Redraws terrain captured from Simple.tese with transform feedback. The
+// capture ran with an identity model matrix so positions are in model space.
+layout(location = 0) in vec3 vertexPosition_modelspace;
+layout(location = 1) in vec2 vertexUV;
+layout(location = 2) in vec3 vertexNormal_modelspace;
+
+// Output data ; will be interpolated for each fragment.
+out vec2 UV;
+out vec3 Position_worldspace;
+out vec3 EyeDirection_cameraspace;
+out vec3 LightDirection_cameraspace;
+out vec3 Normal_cameraspace;
+out vec3 Normal_modelspace;
+
+// Values that stay constant for the whole mesh.
+uniform mat4 MVP;
+uniform mat4 V;
+uniform mat4 M;
+uniform mat3 MV3x3;
+uniform vec3 LightPosition_worldspace;
+
+void main() {
+  gl_Position = MVP * vec4(vertexPosition_modelspace, 1);
+
+  // Position of the vertex, in worldspace : M * position
+  Position_worldspace = (M * vec4(vertexPosition_modelspace, 1)).xyz;
+
+  // Same as Simple.tese from here on
+  vec3 vertexPosition_cameraspace = (V * M * vec4(vertexPosition_modelspace, 1)).xyz;
+  EyeDirection_cameraspace = vec3(0, 0, 0) - vertexPosition_cameraspace;
+
+  vec3 LightPosition_cameraspace = (V * vec4(LightPosition_worldspace, 1)).xyz;
+  LightDirection_cameraspace = -LightPosition_cameraspace;
+
+  UV = vertexUV;
+  Normal_cameraspace = MV3x3 * vertexNormal_modelspace;
+  Normal_modelspace = vertexNormal_modelspace;
+}
@@ -0,0 +1,31 @@
+#version 330 core
+
+// No vertex attributes: each instance is one patch of the terrain grid and
+// gl_VertexID picks the corner, in the same order the index buffer used
+// (top left, top right, bottom left, bottom right).
+
+out vec3 Position_modelspace;
+out vec2 UV;
+out vec3 Normal_modelspace;
+
+// Values that stay constant for the whole mesh.
+uniform int GridPoints;
+uniform float GridScale;
+
+void main() {
+  int cells = GridPoints - 1;
+  ivec2 point = ivec2(gl_InstanceID / cells, gl_InstanceID % cells) +
+                ivec2(gl_VertexID >> 1, gl_VertexID & 1);
+
+  // Center the plane around the zero
+  vec2 xz = GridScale * vec2(point) - (GridScale * GridPoints) / 2.0;
+  vec3 vertexPosition_modelspace = vec3(xz.x, 0, xz.y);
+
+  // Pass to tesselation control shader
+  gl_Position = vec4(vertexPosition_modelspace, 1);
+
+  // Output data
+  Position_modelspace = vertexPosition_modelspace;
+  UV = (vec2(point) + 0.5) / float(cells);
+  Normal_modelspace = vec3(0, 1, 0);
+}
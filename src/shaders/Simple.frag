@@ -26,6 +26,47 @@ uniform mat4 V;
 uniform mat4 M;
 uniform mat3 MV3x3;
 uniform vec3 LightPosition_worldspace;
+uniform vec3 LightColor;
+uniform float LightPower;
+
+// Clustered point lights, laid out as described in common/clusters.hpp
+uniform samplerBuffer ClusterLightSampler;
+uniform usamplerBuffer ClusterGridSampler;
+uniform usamplerBuffer ClusterIndexSampler;
+uniform ivec3 ClusterTiles;
+uniform vec2 ClusterTileSize;
+uniform float ClusterNear;
+uniform float ClusterDepthScale;
+
+// Sum of the point lights in this fragment's cluster, p/n/e in camera space
+vec3 clusteredLighting(vec3 p, vec3 n, vec3 e, vec3 diffuseColor,
+                       vec3 specularColor, float shininess) {
+  ivec2 tile = min(ivec2(gl_FragCoord.xy / ClusterTileSize), ClusterTiles.xy - 1);
+  int slice = clamp(int(log(-p.z / ClusterNear) * ClusterDepthScale), 0,
+                    ClusterTiles.z - 1);
+  int cluster = (slice * ClusterTiles.y + tile.y) * ClusterTiles.x + tile.x;
+  uvec2 range = texelFetch(ClusterGridSampler, cluster).xy;
+
+  vec3 result = vec3(0);
+  for (uint i = 0u; i < range.y; i++) {
+    int light = int(texelFetch(ClusterIndexSampler, int(range.x + i)).r);
+    vec4 positionRadius = texelFetch(ClusterLightSampler, light * 2);
+    vec3 lightColor = texelFetch(ClusterLightSampler, light * 2 + 1).rgb;
+
+    vec3 toLight = positionRadius.xyz - p;
+    float distance = length(toLight);
+    // Inverse square, windowed so it reaches zero at the light's radius
+    float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+    float attenuation = window * window / (distance * distance + 1.0);
+
+    vec3 l = toLight / distance;
+    float cosTheta = clamp(dot(n, l), 0, 1);
+    float cosB = clamp(pow(clamp(dot(n, normalize(l + e)), 0, 1), shininess), 0, 1);
+    cosB = cosB * cosTheta * (shininess + 2) / (2 * radians(180.0f));
+    result += (diffuseColor * cosTheta + specularColor * cosB) * lightColor * attenuation;
+  }
+  return result;
+}
 
 vec3 getTextureAtHeight(sampler2D sA, sampler2D sB, sampler2D sC, float height, vec2 texCoord) {
   // Lowest band, just return the first texture
@@ -59,9 +100,6 @@ vec3 getTextureAtHeight(sampler2D sA, sampler2D sB, sampler2D sC, float height,
 void main() {
 
   // Some properties
-  // should put them as uniforms
-  vec3 LightColor = vec3(1, 1, 1);
-  float LightPower = 1.0;
   float shininess = 1;
 
   vec2 texCoord = fract(UV * 6.0);
@@ -111,7 +149,13 @@ void main() {
   // color = specular;
   // return;
 
+  // Point lights
+  vec3 Position_cameraspace = (V * vec4(Position_worldspace, 1)).xyz;
+  vec3 points = clusteredLighting(Position_cameraspace, n, e, MaterialDiffuseColor,
+                                  MaterialSpecularColor, shininess);
+
   color = MaterialAmbientColor + // Ambient : simulates indirect lighting
           diffuse +              // Diffuse : "color" of the object
-          specular;              // Specular : reflective highlight, like a mirror
+          specular +             // Specular : reflective highlight, like a mirror
+          points;                // Point lights : summed over the fragment's cluster
 }
\ No newline at end of file
@@ -0,0 +1,31 @@
+#version 330 core
+
+in vec2 UV;
+
+// Ouput data
+out vec3 color;
+
+// Low resolution scene, only the bottom left RenderScale part is valid
+uniform sampler2D SceneTextureSampler;
+uniform vec2 RenderScale;
+uniform float Sharpness;
+
+void main() {
+  vec2 texSize = vec2(textureSize(SceneTextureSampler, 0));
+  vec2 texelSize = 1.0 / texSize;
+
+  // Keep the bilinear footprint inside the rendered region
+  vec2 uvMax = RenderScale - 0.5 * texelSize;
+  vec2 uv = min(UV * RenderScale, uvMax);
+
+  vec3 center = texture(SceneTextureSampler, uv).rgb;
+
+  // Unsharp mask to win back some of the detail lost to the upscale
+  vec3 up = texture(SceneTextureSampler, min(uv + vec2(0, texelSize.y), uvMax)).rgb;
+  vec3 down = texture(SceneTextureSampler, max(uv - vec2(0, texelSize.y), vec2(0))).rgb;
+  vec3 left = texture(SceneTextureSampler, max(uv - vec2(texelSize.x, 0), vec2(0))).rgb;
+  vec3 right = texture(SceneTextureSampler, min(uv + vec2(texelSize.x, 0), uvMax)).rgb;
+  vec3 blur = (up + down + left + right) * 0.25;
+
+  color = clamp(center + (center - blur) * Sharpness, 0.0, 1.0);
+}
@@ -0,0 +1,90 @@
+// Offline texture baker: BMP in, block compressed KTX with a full mip chain
+// out. The renderer picks up <name>.ktx in place of <name>.bmp when present.
+//
+//   bake [-f bc1|bc3|bc5] [-linear] texture.bmp...
+//
+// Colour textures default to BC1 with mips filtered in linear light. BC5
+// keeps two independent channels (normal maps, height derivatives) and is
+// always filtered linearly.
+
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <common/texture_bake.hpp>
+
+static bool bakeTexture(const std::string &input, BlockFormat format, bool srgb) {
+  auto start = std::chrono::steady_clock::now();
+
+  Image base;
+  if (!readBMP(input.c_str(), base))
+    return false;
+
+  std::vector<Image> mips = buildMipChain(base, srgb);
+  std::vector<std::vector<uint8_t>> levels;
+  size_t compressedBytes = 0;
+  for (const Image &mip : mips) {
+    levels.push_back(compressImage(mip, format));
+    compressedBytes += levels.back().size();
+  }
+
+  std::string output = input;
+  size_t dot = output.find_last_of('.');
+  if (dot != std::string::npos)
+    output.erase(dot);
+  output += ".ktx";
+
+  if (!writeKTX(output.c_str(), format, base.width, base.height, levels))
+    return false;
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  printf("%s -> %s: %dx%d, %zu levels, %zu KB (was %zu KB), %.1f ms\n",
+         input.c_str(), output.c_str(), base.width, base.height, levels.size(),
+         compressedBytes / 1024, size_t(base.width) * base.height * 3 / 1024, ms);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  BlockFormat format = BlockFormat::BC1;
+  bool srgb = true;
+  std::vector<std::string> inputs;
+
+  for (int i = 1; i < argc; i++) {
+    if (argv[i] == std::string("-f") && i + 1 < argc) {
+      std::string name = argv[++i];
+      if (name == "bc1")
+        format = BlockFormat::BC1;
+      else if (name == "bc3")
+        format = BlockFormat::BC3;
+      else if (name == "bc5")
+        format = BlockFormat::BC5;
+      else {
+        printf("Unknown format %s\n", name.c_str());
+        return 1;
+      }
+      continue;
+    }
+
+    if (argv[i] == std::string("-linear")) {
+      srgb = false;
+      continue;
+    }
+
+    inputs.push_back(argv[i]);
+  }
+
+  if (inputs.empty()) {
+    printf("Usage: %s [-f bc1|bc3|bc5] [-linear] texture.bmp...\n", argv[0]);
+    return 1;
+  }
+
+  int failures = 0;
+  for (const std::string &input : inputs) {
+    if (!bakeTexture(input, format, srgb && format != BlockFormat::BC5))
+      failures++;
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+// Stress test and scaling benchmark for the job system in common/jobs.hpp.
+//
+//   jobbench [stress] [bench] [-rounds N]
+//
+// The stress test hammers scheduling, stealing, dependencies, nested waits
+// and the main-thread queue and exits non-zero if anything is lost or runs
+// out of order. The benchmark runs the same CPU-bound workload with 0..N
+// workers and prints the speedup over running it on the main thread alone.
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <common/jobs.hpp>
+#include <common/parallel.hpp>
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// Something for the CPU to chew on that the compiler can't drop
+static unsigned busyWork(unsigned seed, int iterations) {
+  for (int i = 0; i < iterations; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+  }
+  return seed;
+}
+
+static void stressManySmallJobs(JobSystem &jobs) {
+  const int count = 100000;
+  std::atomic<int> ran{0};
+  JobCounter counter;
+  for (int i = 0; i < count; i++)
+    jobs.run([&ran] { ran.fetch_add(1, std::memory_order_relaxed); }, &counter);
+  jobs.wait(counter);
+  check(ran == count, "every small job runs exactly once");
+}
+
+static void stressDependencyChains(JobSystem &jobs) {
+  const int chains = 64;
+  const int depth = 32;
+  std::vector<std::atomic<int>> stage(chains);
+  std::vector<JobCounter> counters(chains * depth);
+  std::atomic<int> outOfOrder{0};
+  JobCounter all;
+
+  // Stage s of a chain may only start once stage s - 1 finished
+  for (int c = 0; c < chains; c++) {
+    stage[c] = 0;
+    for (int s = 0; s < depth; s++) {
+      auto job = [&, c, s] {
+        if (stage[c].load() != s)
+          outOfOrder++;
+        busyWork(c * depth + s, 1000);
+        stage[c].store(s + 1);
+      };
+      JobCounter &done = counters[c * depth + s];
+      if (s == 0) {
+        jobs.run(job, &done);
+      } else {
+        jobs.runAfter(counters[c * depth + s - 1], job, &done);
+      }
+      // Count the chain's stages against one group counter as well
+      jobs.runAfter(done, [] {}, &all);
+    }
+  }
+  jobs.wait(all);
+
+  bool complete = true;
+  for (int c = 0; c < chains; c++)
+    complete &= stage[c] == depth;
+  check(complete, "every dependency chain runs to the end");
+  check(outOfOrder == 0, "dependent jobs never start early");
+}
+
+// Jobs that spawn jobs and wait on them from inside a worker
+static void spawnTree(JobSystem &jobs, int depth, std::atomic<int> &leaves) {
+  if (depth == 0) {
+    leaves++;
+    return;
+  }
+  JobCounter children;
+  for (int i = 0; i < 4; i++)
+    jobs.run([&jobs, depth, &leaves] { spawnTree(jobs, depth - 1, leaves); }, &children);
+  jobs.wait(children);
+}
+
+static void stressNestedWaits(JobSystem &jobs) {
+  std::atomic<int> leaves{0};
+  JobCounter root;
+  jobs.run([&] { spawnTree(jobs, 6, leaves); }, &root);
+  jobs.wait(root);
+  check(leaves == 4096, "nested waits finish the whole spawn tree");
+}
+
+static void stressMainThreadQueue(JobSystem &jobs) {
+  const int count = 10000;
+  std::atomic<int> onMain{0};
+  std::atomic<int> offMain{0};
+  JobCounter counter;
+  for (int i = 0; i < count; i++) {
+    jobs.run([&] {
+      // Same pattern as a decode job handing its GL upload back
+      jobs.runOnMainThread([&] {
+        if (jobs.isMainThread())
+          onMain++;
+        else
+          offMain++;
+      }, &counter);
+    }, &counter);
+  }
+  jobs.wait(counter);
+  check(onMain == count, "every main-thread completion runs");
+  check(offMain == 0, "main-thread completions never run on a worker");
+}
+
+// A parallelFor in the middle of a GL sequence, like the heightmap upload,
+// with main-thread tasks queued before and during it that unbind the
+// "texture" the way an upload completion does. Those must wait until the
+// loop has returned.
+static void stressParallelForKeepsMainState() {
+  JobSystem &jobs = jobSystem();
+  const int count = 1000;
+  int boundTexture = 42;
+  std::atomic<int> covered{0};
+  std::atomic<int> unbinds{0};
+  JobCounter uploads;
+
+  auto unbind = [&] {
+    boundTexture = 0;
+    unbinds++;
+  };
+  jobs.runOnMainThread(unbind, &uploads);
+  parallelFor(count, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      busyWork(i + 1, 10000);
+      covered++;
+    }
+    jobs.runOnMainThread(unbind, &uploads);
+  });
+  check(covered == count, "parallelFor covers the whole range");
+  check(boundTexture == 42, "parallelFor leaves main-thread work queued");
+
+  jobs.wait(uploads);
+  check(boundTexture == 0 && unbinds > 0, "main-thread work runs on the next wait");
+}
+
+static void stress(int rounds) {
+  JobSystem jobs;
+  printf("Stress test, %d workers, %d rounds\n", jobs.workerCount(), rounds);
+  for (int round = 0; round < rounds && failures == 0; round++) {
+    stressManySmallJobs(jobs);
+    stressDependencyChains(jobs);
+    stressNestedWaits(jobs);
+    stressMainThreadQueue(jobs);
+    stressParallelForKeepsMainState();
+  }
+  printf("Stress test %s\n", failures == 0 ? "passed" : "FAILED");
+}
+
+static void bench() {
+  const int jobCount = 4096;
+  const int iterations = 20000;
+  int maxWorkers = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+
+  printf("Scaling benchmark, %d jobs of %d iterations\n", jobCount, iterations);
+  double baseline = 0.0;
+  for (int workers = 0; workers <= maxWorkers; workers++) {
+    JobSystem jobs(workers);
+    std::atomic<unsigned> sink{0};
+
+    auto start = std::chrono::steady_clock::now();
+    JobCounter counter;
+    for (int i = 0; i < jobCount; i++)
+      jobs.run([&sink, i] { sink += busyWork(i + 1, iterations); }, &counter);
+    jobs.wait(counter);
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+    if (workers == 0)
+      baseline = ms;
+    printf("%3d threads: %8.2f ms, %5.2fx (%u)\n", workers + 1, ms,
+           baseline / ms, sink.load());
+  }
+}
+
+int main(int argc, char *argv[]) {
+  bool runStress = false;
+  bool runBench = false;
+  int rounds = 20;
+
+  for (int i = 1; i < argc; i++) {
+    if (argv[i] == std::string("stress")) {
+      runStress = true;
+      continue;
+    }
+    if (argv[i] == std::string("bench")) {
+      runBench = true;
+      continue;
+    }
+    if (argv[i] == std::string("-rounds") && i + 1 < argc) {
+      rounds = std::stoi(argv[++i]);
+      continue;
+    }
+  }
+  if (!runStress && !runBench)
+    runStress = runBench = true;
+
+  if (runStress)
+    stress(rounds);
+  if (runBench && failures == 0)
+    bench();
+
+  return failures == 0 ? 0 : 1;
+}